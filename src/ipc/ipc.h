@@ -7,15 +7,93 @@
  #define IPC_LOG_NAME "ipc"
 #endif
 
+#include "ipc_fragment.h"
+#include "ipc_latest.h"
+#include "ipc_notify.h"
+#include "ipc_overflow.h"
 #include "ipc_proc.h"
 #include "ipc_ring.h"
 #include "ipc_sem.h"
 #include "ipc_shm.h"
+#include "ipc_snapshot.h"
 
+#ifndef _WIN32
+ #ifdef __cplusplus
+  #include <ctime>
+ #else
+  #include <time.h>
+ #endif
+ #include <unistd.h>
+#endif
+
+// what to do with a message when there is no room for it in the ring
+typedef enum {
+    // give up right away, the write fails (default)
+    ipc_write_policy_drop_newest,
+    // keep the latest message with the same type and key (first uint32 of the header) until there is room.
+    // the write does not fail, older messages are dropped instead. meant for meters and similar.
+    // kept messages are unordered relative to other types, they may arrive before or after later writes.
+    ipc_write_policy_drop_oldest,
+    // commit and wait for the other side to make room, up to a timeout, then give up like drop_newest
+    ipc_write_policy_block,
+    // queue in private memory until there is room, see ipc_fragment.h
+    ipc_write_policy_never_drop,
+} ipc_write_policy_t;
+
+typedef struct {
+    ipc_write_policy_t policy;
+    uint32_t timeout_usecs;
+} ipc_write_policy_config_t;
+
+// message types that can have their own policy, others always use the default
+#define IPC_WRITE_POLICY_TYPES 32
+
+// sleep between checks for room while blocking
+#define IPC_WRITE_BLOCK_STEP_USECS 250
+
+// per direction, meant to be cheap enough to be always on.
+// all but lost and wake_latency_ns are only updated by the writing side, with relaxed atomics.
+// last_commit_ns is also cleared by the reading side once it woke up for that commit.
 typedef struct {
-    ipc_sem_t sem_server;
-    ipc_sem_t sem_client;
-    uint8_t rbdata[];
+    // messages and bytes accepted for sending
+    uint64_t messages, bytes;
+    // writes that found no room in the ring
+    uint32_t overflows;
+    // messages lost, either refused or replaced by a newer one
+    uint32_t drops;
+    // side channel messages the reading side could not map, updated by the reading side
+    uint32_t lost;
+    // commits that left messages waiting for room
+    uint32_t commit_failures;
+    // highest ring usage seen on commit, in bytes
+    uint32_t high_water;
+    // synchronous request/response waits, counted by the application (e.g. URID lookups)
+    uint32_t roundtrips;
+    // time of the last commit not yet woken up for, see ipc_time_ns
+    uint64_t last_commit_ns;
+    // time between the last commit and the reading side waking up for it, updated by the reading side
+    uint64_t wake_latency_ns;
+} ipc_stats_t;
+
+typedef struct {
+    IPC_ALIGNAS(IPC_CACHELINE_SIZE) ipc_sem_t sem_server;
+    // pollable alternative to sem_server, fd number valid in the client process or -1.
+    // only signaled when notify_server_pending goes from 0 to 1, the client resets it before reading.
+    int32_t notify_server_fd;
+    uint32_t notify_server_pending;
+    // set while the client has not taken the last message the server sent through the side channel
+    uint32_t overflow_server_busy;
+    // size of each ring, chosen by the server side
+    uint32_t rbsize;
+    IPC_ALIGNAS(IPC_CACHELINE_SIZE) ipc_sem_t sem_client;
+    // same for the other direction, fd number for writing valid in the client process or -1
+    int32_t notify_client_fd;
+    uint32_t notify_client_pending;
+    uint32_t overflow_client_busy;
+    // for monitoring, see lv2-gtk-ui-bridge-stat
+    IPC_ALIGNAS(IPC_CACHELINE_SIZE) ipc_stats_t stats_server;
+    IPC_ALIGNAS(IPC_CACHELINE_SIZE) ipc_stats_t stats_client;
+    IPC_ALIGNAS(IPC_CACHELINE_SIZE) uint8_t rbdata[];
 } ipc_shared_data_t;
 
 typedef struct {
@@ -23,12 +101,29 @@ typedef struct {
     ipc_ring_t* ring_send;
     ipc_ring_t* ring_recv;
     ipc_proc_t* proc;
+    ipc_notify_t notify_send;
+    ipc_notify_t notify_recv;
+    ipc_overflow_writer_t overflow_send;
+    ipc_overflow_reader_t overflow_recv;
+    ipc_fragment_writer_t fragment_send;
+    ipc_fragment_reader_t fragment_recv;
+    ipc_latest_t latest_send;
+    ipc_write_policy_config_t write_policies[IPC_WRITE_POLICY_TYPES];
+    char name[IPC_SHM_NAME_SIZE];
 } ipc_server_t;
 
 typedef struct {
     ipc_shm_client_t shm;
     ipc_ring_t* ring_recv;
     ipc_ring_t* ring_send;
+    ipc_notify_t notify_send;
+    ipc_overflow_writer_t overflow_send;
+    ipc_overflow_reader_t overflow_recv;
+    ipc_fragment_writer_t fragment_send;
+    ipc_fragment_reader_t fragment_recv;
+    ipc_latest_t latest_send;
+    ipc_write_policy_config_t write_policies[IPC_WRITE_POLICY_TYPES];
+    char name[IPC_SHM_NAME_SIZE];
 } ipc_client_t;
 
 // --------------------------------------------------------------------------------------------------------------------
@@ -39,10 +134,41 @@ static inline
 bool ipc_server_check(const char* name);
 
 /*
+ * `rbsize` is the size of each ring, the client side picks it up from the shared memory.
+ * Messages larger than a fraction of it go through a separate region created on demand, see ipc_overflow.h.
  */
 static inline
 ipc_server_t* ipc_server_start(const char* args[], const char* name, uint32_t rbsize);
 
+/*
+ * Same as ipc_server_start but does not wait for the client side to attach.
+ * Messages can be written right away, the client side receives them once it attaches.
+ */
+static inline
+ipc_server_t* ipc_server_launch(const char* args[], const char* name, uint32_t rbsize);
+
+/*
+ * Create the shared memory side only, for clients living in an already running process.
+ * ipc_server_is_running always returns false for servers created this way.
+ */
+static inline
+ipc_server_t* ipc_server_create(const char* name, uint32_t rbsize);
+
+/*
+ * Replace a server whose client process exited with a new one, using a new shared memory segment called `name`.
+ * The pollable handle of `server` is kept, so that event loops watching it need no changes.
+ * On success `server` is stopped, otherwise it is left untouched.
+ */
+static inline
+ipc_server_t* ipc_server_respawn(ipc_server_t* server, const char* args[], const char* name);
+
+/*
+ * Make commits on `server` wake up the pollable handle of `other`.
+ * Used together with ipc_server_create, when the client lives in the process started by `other`.
+ */
+static inline
+void ipc_server_share_notify(ipc_server_t* server, const ipc_server_t* other);
+
 /*
  */
 static inline
@@ -53,32 +179,92 @@ void ipc_server_stop(ipc_server_t* server);
 static inline
 bool ipc_server_is_running(ipc_server_t* server);
 
+/*
+ * What happens when there is no room for the message depends on the policy set for its type.
+ * Large messages are always kept and sent over the next commits, in fragments if needed.
+ * While large or never_drop messages are waiting, writes that would otherwise fail right away keep failing,
+ * so that order is preserved. Messages kept by drop_oldest are not part of this order, see ipc_write_policy_t.
+ */
+static inline
+bool ipc_server_write_msg(ipc_server_t* server,
+                          uint32_t type,
+                          const void* header, uint32_t header_size,
+                          const void* payload, uint32_t payload_size);
+
 /*
  */
 static inline
-bool ipc_server_read(ipc_server_t* server, void* dst, uint32_t size);
+bool ipc_server_peek_msg(ipc_server_t* server, ipc_ring_msg_t* msg);
 
 /*
  */
 static inline
-bool ipc_server_write(ipc_server_t* server, const void* src, uint32_t size);
+void ipc_server_consume_msg(ipc_server_t* server, const ipc_ring_msg_t* msg, void* dst);
 
 /*
  */
 static inline
+const uint8_t* ipc_server_acquire_msg(ipc_server_t* server, ipc_ring_msg_t* msg);
+
+/*
+ */
+static inline
+void ipc_server_release_msgs(ipc_server_t* server);
+
+/*
+ * Also writes whatever fits of a message being sent in fragments.
+ */
+static inline
 bool ipc_server_commit(ipc_server_t* server);
 
+/*
+ * Amount of bytes still waiting for room in the ring, commit again later while not 0.
+ */
+static inline
+uint32_t ipc_server_backlog_size(ipc_server_t* server);
+
+/*
+ * Set the policy for writing messages of `type` when the ring is full.
+ * `timeout_usecs` is only used for ipc_write_policy_block.
+ */
+static inline
+void ipc_server_set_write_policy(ipc_server_t* server, uint32_t type, ipc_write_policy_t policy, uint32_t timeout_usecs);
+
+/*
+ * Get statistics of messages sent and received.
+ */
+static inline
+void ipc_server_get_stats(ipc_server_t* server, ipc_stats_t* send, ipc_stats_t* recv);
+
 /*
  */
 static inline
 bool ipc_server_wait_secs(ipc_server_t* server, uint32_t secs);
 
+/*
+ */
+static inline
+bool ipc_server_wait_usecs(ipc_server_t* server, uint32_t usecs);
+
+/*
+ * Pollable handle signaled on client commits, or -1 if not available.
+ * Once readable, call ipc_server_notify_clear before reading messages.
+ */
+static inline
+int32_t ipc_server_notify_fd(ipc_server_t* server);
+
+/*
+ */
+static inline
+void ipc_server_notify_clear(ipc_server_t* server);
+
 // --------------------------------------------------------------------------------------------------------------------
 
 /*
+ * Ring size is read from the shared memory, as chosen by the server side.
  */
 static inline
-ipc_client_t* ipc_client_attach(const char* name, uint32_t rbsize);
+ipc_client_t* ipc_client_attach(const char* name);
 
 /*
  */
@@ -88,23 +274,405 @@ void ipc_client_dettach(ipc_client_t* client);
 /*
  */
 static inline
-bool ipc_client_read(ipc_client_t* client, void* dst, uint32_t size);
+bool ipc_client_write_msg(ipc_client_t* client,
+                          uint32_t type,
+                          const void* header, uint32_t header_size,
+                          const void* payload, uint32_t payload_size);
+
+/*
+ */
+static inline
+bool ipc_client_peek_msg(ipc_client_t* client, ipc_ring_msg_t* msg);
+
+/*
+ */
+static inline
+void ipc_client_consume_msg(ipc_client_t* client, const ipc_ring_msg_t* msg, void* dst);
+
+/*
+ */
+static inline
+const uint8_t* ipc_client_acquire_msg(ipc_client_t* client, ipc_ring_msg_t* msg);
 
 /*
  */
 static inline
-bool ipc_client_write(ipc_client_t* client, const void* src, uint32_t size);
+void ipc_client_release_msgs(ipc_client_t* client);
 
 /*
  */
 static inline
 bool ipc_client_commit(ipc_client_t* client);
 
+/*
+ */
+static inline
+uint32_t ipc_client_backlog_size(ipc_client_t* client);
+
+/*
+ */
+static inline
+void ipc_client_set_write_policy(ipc_client_t* client, uint32_t type, ipc_write_policy_t policy, uint32_t timeout_usecs);
+
+/*
+ */
+static inline
+void ipc_client_get_stats(ipc_client_t* client, ipc_stats_t* send, ipc_stats_t* recv);
+
+/*
+ * Count a synchronous wait for an answer from the server side, only used for statistics.
+ */
+static inline
+void ipc_client_count_roundtrip(ipc_client_t* client);
+
 /*
  */
 static inline
 bool ipc_client_wait_secs(ipc_client_t* client, uint32_t secs);
 
+/*
+ */
+static inline
+bool ipc_client_wait_usecs(ipc_client_t* client, uint32_t usecs);
+
+/*
+ * Pollable handle signaled on server commits, or -1 if not available.
+ * Once readable, clear it with ipc_notify_clear and call ipc_client_notify_rearm before reading messages.
+ */
+static inline
+int32_t ipc_client_notify_fd(ipc_client_t* client);
+
+/*
+ */
+static inline
+void ipc_client_notify_rearm(ipc_client_t* client);
+
+// --------------------------------------------------------------------------------------------------------------------
+
+// monotonic time in nanoseconds, comparable between processes
+static inline
+uint64_t ipc_time_ns(void)
+{
+   #ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+   #else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+   #endif
+}
+
+// only ever written by one side, so no need for read-modify-write atomics
+#define __ipc_stats_add(ptr, val) __atomic_store_n(ptr, *(ptr) + (val), __ATOMIC_RELAXED)
+
+static inline
+void __ipc_stats_commit(ipc_stats_t* const stats, ipc_ring_t* const ring)
+{
+    const uint32_t used = ring->size - 1 - ipc_ring_write_size(ring);
+
+    if (used > stats->high_water)
+        __atomic_store_n(&stats->high_water, used, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&stats->last_commit_ns, ipc_time_ns(), __ATOMIC_RELAXED);
+}
+
+static inline
+void __ipc_stats_woken(ipc_stats_t* const stats)
+{
+    // taken, so that later wakeups without a new commit do not count the time since this one
+    const uint64_t last_commit_ns = __atomic_exchange_n(&stats->last_commit_ns, 0, __ATOMIC_RELAXED);
+
+    if (last_commit_ns != 0)
+        __atomic_store_n(&stats->wake_latency_ns, ipc_time_ns() - last_commit_ns, __ATOMIC_RELAXED);
+}
+
+static inline
+void __ipc_stats_load(ipc_stats_t* const dst, const ipc_stats_t* const src)
+{
+    dst->messages = __atomic_load_n(&src->messages, __ATOMIC_RELAXED);
+    dst->bytes = __atomic_load_n(&src->bytes, __ATOMIC_RELAXED);
+    dst->overflows = __atomic_load_n(&src->overflows, __ATOMIC_RELAXED);
+    dst->drops = __atomic_load_n(&src->drops, __ATOMIC_RELAXED);
+    dst->lost = __atomic_load_n(&src->lost, __ATOMIC_RELAXED);
+    dst->commit_failures = __atomic_load_n(&src->commit_failures, __ATOMIC_RELAXED);
+    dst->high_water = __atomic_load_n(&src->high_water, __ATOMIC_RELAXED);
+    dst->roundtrips = __atomic_load_n(&src->roundtrips, __ATOMIC_RELAXED);
+    dst->last_commit_ns = __atomic_load_n(&src->last_commit_ns, __ATOMIC_RELAXED);
+    dst->wake_latency_ns = __atomic_load_n(&src->wake_latency_ns, __ATOMIC_RELAXED);
+}
+
+static inline
+ipc_write_policy_config_t __ipc_write_policy(const ipc_write_policy_config_t* const policies, const uint32_t type)
+{
+    if (type < IPC_WRITE_POLICY_TYPES)
+        return policies[type];
+
+    const ipc_write_policy_config_t config = { ipc_write_policy_drop_newest, 0 };
+    return config;
+}
+
+static inline
+bool __ipc_write_is_large(const ipc_ring_t* const ring, const uint32_t size)
+{
+    return __ipc_ring_msg_size(size) > ring->size / IPC_OVERFLOW_RING_FRACTION;
+}
+
+// check if a message can be written right now, giving messages still waiting a chance first
+static inline
+bool __ipc_write_has_room(ipc_ring_t* const ring, ipc_fragment_writer_t* const fragment, const uint32_t size)
+{
+    if (ipc_fragment_writer_pending(fragment) != 0 && ! ipc_fragment_writer_flush(fragment, ring))
+        return false;
+
+    return ipc_ring_can_write_msg(ring, size);
+}
+
+static inline
+void __ipc_write_sleep(void)
+{
+   #ifdef _WIN32
+    Sleep(1);
+   #else
+    usleep(IPC_WRITE_BLOCK_STEP_USECS);
+   #endif
+}
+
+static inline
+bool __ipc_write_msg(ipc_ring_t* const ring,
+                     ipc_overflow_writer_t* const overflow, uint32_t* const busy,
+                     ipc_fragment_writer_t* const fragment,
+                     ipc_latest_t* const latest,
+                     ipc_stats_t* const stats,
+                     const char* const name, const char dir,
+                     const ipc_write_policy_t policy,
+                     const uint32_t type,
+                     const void* const header, const uint32_t header_size,
+                     const void* const payload, const uint32_t payload_size)
+{
+    assert(type != IPC_RING_MSG_OVERFLOW);
+    assert(type != IPC_RING_MSG_FRAGMENT);
+
+    const uint32_t size = header_size + payload_size;
+    const uint32_t key = policy == ipc_write_policy_drop_oldest ? ipc_latest_key(header, header_size) : 0;
+    const bool large = __ipc_write_is_large(ring, size);
+
+    // messages queued earlier go first, so that order is kept (drop_oldest ones excepted, see ipc_write_policy_t)
+    const bool waiting = ipc_fragment_writer_pending(fragment) != 0 && ! ipc_fragment_writer_flush(fragment, ring);
+
+    if (! waiting)
+    {
+        if (latest->count != 0)
+            ipc_latest_flush(latest, ring);
+
+        // keep large messages out of the ring when possible, so they do not hold back the small frequent ones
+        if (large && ipc_overflow_write_msg(overflow, busy, ring, name, dir, type, header, header_size, payload, payload_size))
+            return true;
+
+        if (ipc_ring_can_write_msg(ring, size))
+        {
+            ipc_ring_write_msg(ring, type, header, header_size, payload, payload_size);
+
+            // an older message still waiting for room is outdated now
+            if (policy == ipc_write_policy_drop_oldest && ipc_latest_remove(latest, type, key))
+                __ipc_stats_add(&stats->drops, 1);
+
+            return true;
+        }
+    }
+
+    __ipc_stats_add(&stats->overflows, 1);
+
+    switch (policy)
+    {
+    case ipc_write_policy_drop_oldest:
+        if (! large)
+        {
+            bool replaced;
+            if (ipc_latest_store(latest, type, key, header, header_size, payload, payload_size, &replaced))
+            {
+                if (replaced)
+                    __ipc_stats_add(&stats->drops, 1);
+
+                return true;
+            }
+        }
+        break;
+    case ipc_write_policy_never_drop:
+        if (ipc_fragment_write_msg(fragment, ring, type, header, header_size, payload, payload_size))
+            return true;
+        break;
+    default:
+        break;
+    }
+
+    // large messages are costly to produce again, send them in pieces instead of losing them
+    if (large && policy != ipc_write_policy_never_drop &&
+        ipc_fragment_write_msg(fragment, ring, type, header, header_size, payload, payload_size))
+        return true;
+
+    __ipc_stats_add(&stats->drops, 1);
+    return false;
+}
+
+// a side channel reference that cannot be resolved is of no use to the caller.
+// drop it here and let the producer use the side channel again, with a new region.
+static inline
+void __ipc_overflow_lost(uint32_t* const busy, ipc_stats_t* const stats)
+{
+    ipc_overflow_lost(busy);
+    __ipc_stats_add(&stats->lost, 1);
+}
+
+static inline
+bool __ipc_peek_msg(ipc_ring_t* const ring,
+                    ipc_overflow_reader_t* const overflow, uint32_t* const busy,
+                    ipc_fragment_reader_t* const fragment,
+                    ipc_stats_t* const stats,
+                    const char* const name, const char dir,
+                    ipc_ring_msg_t* const msg)
+{
+    overflow->peeked = false;
+
+    // reassembled already, waiting to be consumed
+    if (fragment->complete)
+    {
+        msg->type = fragment->type;
+        msg->size = fragment->size;
+        return true;
+    }
+
+    for (;;)
+    {
+        const uint8_t* const data = __ipc_ring_next_msg(ring, msg);
+
+        if (data == NULL)
+            return false;
+
+        if (msg->type == IPC_RING_MSG_FRAGMENT)
+        {
+            const ipc_ring_msg_t ring_msg = *msg;
+            const int ret = ipc_fragment_read(fragment, msg, data);
+
+            // invalid, let the caller handle it as an unknown message
+            if (ret < 0)
+                return true;
+
+            ipc_ring_consume_msg(ring, &ring_msg, NULL);
+
+            if (ret == 0)
+                continue;
+
+            fragment->complete = true;
+            return true;
+        }
+
+        if (msg->type == IPC_RING_MSG_OVERFLOW)
+        {
+            overflow->ring_msg = *msg;
+            overflow->peeked = ipc_overflow_resolve(overflow, name, dir, msg, data) != NULL;
+
+            if (! overflow->peeked)
+            {
+                ipc_ring_consume_msg(ring, &overflow->ring_msg, NULL);
+                __ipc_overflow_lost(busy, stats);
+                continue;
+            }
+        }
+
+        return true;
+    }
+}
+
+static inline
+void __ipc_consume_msg(ipc_ring_t* const ring,
+                       ipc_overflow_reader_t* const overflow, uint32_t* const busy,
+                       ipc_fragment_reader_t* const fragment,
+                       const ipc_ring_msg_t* const msg, void* const dst)
+{
+    if (fragment->complete)
+    {
+        if (dst != NULL && msg->size != 0)
+            memcpy(dst, fragment->data, msg->size);
+
+        fragment->complete = false;
+        return;
+    }
+
+    if (! overflow->peeked)
+    {
+        ipc_ring_consume_msg(ring, msg, dst);
+        return;
+    }
+
+    if (dst != NULL && msg->size != 0)
+        memcpy(dst, overflow->shm.ptr, msg->size);
+
+    ipc_ring_consume_msg(ring, &overflow->ring_msg, NULL);
+    overflow->peeked = false;
+    ipc_overflow_done(busy);
+}
+
+static inline
+const uint8_t* __ipc_acquire_msg(ipc_ring_t* const ring,
+                                 ipc_overflow_reader_t* const overflow, uint32_t* const busy,
+                                 ipc_fragment_reader_t* const fragment,
+                                 ipc_stats_t* const stats,
+                                 const char* const name, const char dir,
+                                 ipc_ring_msg_t* const msg)
+{
+    for (;;)
+    {
+        const uint8_t* data;
+
+        while ((data = ipc_ring_acquire_msg(ring, msg)) != NULL && msg->type == IPC_RING_MSG_FRAGMENT)
+        {
+            const int ret = ipc_fragment_read(fragment, msg, data);
+
+            // invalid, let the caller handle it as an unknown message
+            if (ret < 0)
+                return data;
+
+            if (ret > 0)
+            {
+                fragment->acquired = true;
+                return fragment->data;
+            }
+        }
+
+        if (data == NULL || msg->type != IPC_RING_MSG_OVERFLOW)
+            return data;
+
+        const uint8_t* const overflow_data = ipc_overflow_resolve(overflow, name, dir, msg, data);
+
+        if (overflow_data != NULL)
+        {
+            overflow->acquired = true;
+            return overflow_data;
+        }
+
+        // the reference is given back together with the other acquired messages
+        __ipc_overflow_lost(busy, stats);
+    }
+}
+
+static inline
+void __ipc_release_msgs(ipc_ring_t* const ring,
+                        ipc_overflow_reader_t* const overflow, uint32_t* const busy,
+                        ipc_fragment_reader_t* const fragment)
+{
+    ipc_ring_release_msgs(ring);
+    ipc_fragment_reader_release(fragment);
+
+    if (overflow->acquired)
+    {
+        overflow->acquired = false;
+        ipc_overflow_done(busy);
+    }
+}
+
 // --------------------------------------------------------------------------------------------------------------------
 
 static inline
@@ -115,6 +683,97 @@ bool ipc_server_check(const char* const name)
 
 static inline
 ipc_server_t* ipc_server_start(const char* args[], const char* const name, const uint32_t rbsize)
+{
+    ipc_server_t* const server = ipc_server_launch(args, name, rbsize);
+    if (server == NULL)
+        return NULL;
+
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
+
+    for (int i = 0; i < 5 && ipc_proc_is_running(server->proc); ++i)
+    {
+        if (ipc_sem_wait_secs(&shared_data->sem_server, 1))
+            return server;
+    }
+
+    fprintf(stderr, "[" IPC_LOG_NAME "] client side failed to start\n");
+    ipc_server_stop(server);
+    return NULL;
+}
+
+// start the client process, with `notify_recv` already set up or to be created
+static inline
+bool __ipc_server_launch_proc(ipc_server_t* const server, const char* args[])
+{
+    // inherited by the client process, which sees the same fd numbers
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
+
+    if (ipc_notify_create(&server->notify_send))
+        shared_data->notify_server_fd = server->notify_send.rfd;
+
+    if (server->notify_recv.wfd >= 0 || ipc_notify_create(&server->notify_recv))
+        shared_data->notify_client_fd = server->notify_recv.wfd;
+
+    // only the ends used by the client side, and only for this process
+    int32_t inherit_fds[3];
+    int num_inherit_fds = 0;
+
+    if (server->notify_send.rfd >= 0)
+        inherit_fds[num_inherit_fds++] = server->notify_send.rfd;
+    if (server->notify_recv.wfd >= 0)
+        inherit_fds[num_inherit_fds++] = server->notify_recv.wfd;
+
+    inherit_fds[num_inherit_fds] = -1;
+    server->proc = ipc_proc_start(args, inherit_fds);
+
+    return server->proc != NULL;
+}
+
+static inline
+ipc_server_t* ipc_server_launch(const char* args[], const char* const name, const uint32_t rbsize)
+{
+    ipc_server_t* const server = ipc_server_create(name, rbsize);
+    if (server == NULL)
+        return NULL;
+
+    if (! __ipc_server_launch_proc(server, args))
+    {
+        ipc_server_stop(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+static inline
+ipc_server_t* ipc_server_respawn(ipc_server_t* const old_server, const char* args[], const char* const name)
+{
+    const ipc_shared_data_t* const old_shared_data = (const ipc_shared_data_t*)old_server->shm.ptr;
+
+    ipc_server_t* const server = ipc_server_create(name, old_shared_data->rbsize);
+    if (server == NULL)
+        return NULL;
+
+    // take over the pollable handle, anything signaled for the old process is simply a spurious wakeup
+    server->notify_recv = old_server->notify_recv;
+
+    if (! __ipc_server_launch_proc(server, args))
+    {
+        // still owned by the old server, unless there was none and it was created just now
+        if (old_server->notify_recv.wfd >= 0)
+            server->notify_recv.rfd = server->notify_recv.wfd = -1;
+
+        ipc_server_stop(server);
+        return NULL;
+    }
+
+    old_server->notify_recv.rfd = old_server->notify_recv.wfd = -1;
+    ipc_server_stop(old_server);
+    return server;
+}
+
+static inline
+ipc_server_t* ipc_server_create(const char* const name, const uint32_t rbsize)
 {
     ipc_server_t* const server = (ipc_server_t*)calloc(1, sizeof(ipc_server_t));
     if (server == NULL)
@@ -123,7 +782,7 @@ ipc_server_t* ipc_server_start(const char* args[], const char* const name, const
         return NULL;
     }
 
-    const uint32_t shared_data_size = sizeof(ipc_shared_data_t) + (sizeof(ipc_ring_t) + rbsize) * 2;
+    const uint32_t shared_data_size = sizeof(ipc_shared_data_t) + ipc_ring_alloc_size(rbsize) * 2;
 
     if (! ipc_shm_server_create(&server->shm, name, shared_data_size, false))
     {
@@ -135,10 +794,17 @@ ipc_server_t* ipc_server_start(const char* args[], const char* const name, const
     ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
     memset(shared_data, 0, shared_data_size);
 
+    strncpy(server->name, name, IPC_SHM_NAME_SIZE - 1);
+    shared_data->rbsize = rbsize;
+    shared_data->notify_server_fd = -1;
+    shared_data->notify_client_fd = -1;
+    server->notify_send.rfd = server->notify_send.wfd = -1;
+    server->notify_recv.rfd = server->notify_recv.wfd = -1;
+
     server->ring_send = (ipc_ring_t*)shared_data->rbdata;
     ipc_ring_init(server->ring_send, rbsize);
 
-    server->ring_recv = (ipc_ring_t*)(shared_data->rbdata + sizeof(ipc_ring_t) + rbsize);
+    server->ring_recv = (ipc_ring_t*)(shared_data->rbdata + ipc_ring_alloc_size(rbsize));
     ipc_ring_init(server->ring_recv, rbsize);
 
     if (! ipc_sem_create(&shared_data->sem_server))
@@ -158,25 +824,7 @@ ipc_server_t* ipc_server_start(const char* args[], const char* const name, const
         return NULL;
     }
 
-    server->proc = ipc_proc_start(args);
-    if (server->proc == NULL)
-    {
-        ipc_sem_destroy(&shared_data->sem_server);
-        ipc_sem_destroy(&shared_data->sem_client);
-        ipc_shm_server_destroy(&server->shm);
-        free(server);
-        return NULL;
-    }
-
-    for (int i = 0; i < 5 && ipc_proc_is_running(server->proc); ++i)
-    {
-        if (ipc_sem_wait_secs(&shared_data->sem_server, 1))
-            return server;
-    }
-
-    fprintf(stderr, "[" IPC_LOG_NAME "] client side failed to start\n");
-    ipc_server_stop(server);
-    return NULL;
+    return server;
 }
 
 static inline
@@ -184,17 +832,38 @@ void ipc_server_stop(ipc_server_t* const server)
 {
     ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
 
-    ipc_proc_stop(server->proc);
+    if (server->proc != NULL)
+        ipc_proc_stop(server->proc);
+
+    ipc_notify_destroy(&server->notify_send);
+    ipc_notify_destroy(&server->notify_recv);
+    ipc_overflow_writer_destroy(&server->overflow_send);
+    ipc_overflow_reader_destroy(&server->overflow_recv);
+    ipc_fragment_writer_destroy(&server->fragment_send);
+    ipc_fragment_reader_destroy(&server->fragment_recv);
     ipc_sem_destroy(&shared_data->sem_server);
     ipc_sem_destroy(&shared_data->sem_client);
     ipc_shm_server_destroy(&server->shm);
     free(server);
 }
 
+static inline
+void ipc_server_share_notify(ipc_server_t* const server, const ipc_server_t* const other)
+{
+    ipc_notify_destroy(&server->notify_send);
+
+    if (ipc_notify_dup(&server->notify_send, &other->notify_send))
+    {
+        ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
+        const ipc_shared_data_t* const other_shared_data = (const ipc_shared_data_t*)other->shm.ptr;
+        shared_data->notify_server_fd = other_shared_data->notify_server_fd;
+    }
+}
+
 static inline
 bool ipc_server_is_running(ipc_server_t* const server)
 {
-    return ipc_proc_is_running(server->proc);
+    return server->proc != NULL && ipc_proc_is_running(server->proc);
 }
 
 static inline
@@ -204,41 +873,186 @@ uint32_t ipc_server_read_size(ipc_server_t* const server)
 }
 
 static inline
-bool ipc_server_read(ipc_server_t* const server, void* const dst, const uint32_t size)
+bool ipc_server_write_msg(ipc_server_t* const server,
+                          const uint32_t type,
+                          const void* const header, const uint32_t header_size,
+                          const void* const payload, const uint32_t payload_size)
 {
-    return ipc_ring_read(server->ring_recv, dst, size);
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
+    const ipc_write_policy_config_t policy = __ipc_write_policy(server->write_policies, type);
+    const uint32_t size = header_size + payload_size;
+
+    // give the other side a chance to make room before giving up
+    if (policy.policy == ipc_write_policy_block && ! __ipc_write_is_large(server->ring_send, size))
+    {
+        // sleeps can take much longer than asked for (Sleep(1) on Windows), go by the real time
+        const uint64_t deadline = ipc_time_ns() + (uint64_t)policy.timeout_usecs * 1000;
+
+        while (! __ipc_write_has_room(server->ring_send, &server->fragment_send, size) && ipc_time_ns() < deadline)
+        {
+            ipc_server_commit(server);
+            __ipc_write_sleep();
+        }
+    }
+
+    ipc_stats_t* const stats = &shared_data->stats_server;
+
+    if (! __ipc_write_msg(server->ring_send, &server->overflow_send, &shared_data->overflow_server_busy,
+                          &server->fragment_send, &server->latest_send, stats,
+                          server->name, 's', policy.policy, type, header, header_size, payload, payload_size))
+        return false;
+
+    __ipc_stats_add(&stats->messages, 1);
+    __ipc_stats_add(&stats->bytes, size);
+    return true;
+}
+
+static inline
+bool ipc_server_peek_msg(ipc_server_t* const server, ipc_ring_msg_t* const msg)
+{
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
+    return __ipc_peek_msg(server->ring_recv, &server->overflow_recv, &shared_data->overflow_client_busy,
+                          &server->fragment_recv, &shared_data->stats_client, server->name, 'c', msg);
 }
 
 static inline
-bool ipc_server_write(ipc_server_t* const server, const void* const src, const uint32_t size)
+void ipc_server_consume_msg(ipc_server_t* const server, const ipc_ring_msg_t* const msg, void* const dst)
 {
-    return ipc_ring_write(server->ring_send, src, size);
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
+    __ipc_consume_msg(server->ring_recv, &server->overflow_recv, &shared_data->overflow_client_busy, &server->fragment_recv, msg, dst);
+}
+
+static inline
+const uint8_t* ipc_server_acquire_msg(ipc_server_t* const server, ipc_ring_msg_t* const msg)
+{
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
+    return __ipc_acquire_msg(server->ring_recv, &server->overflow_recv, &shared_data->overflow_client_busy,
+                             &server->fragment_recv, &shared_data->stats_client, server->name, 'c', msg);
+}
+
+static inline
+void ipc_server_release_msgs(ipc_server_t* const server)
+{
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
+    __ipc_release_msgs(server->ring_recv, &server->overflow_recv, &shared_data->overflow_client_busy, &server->fragment_recv);
 }
 
 static inline
 bool ipc_server_commit(ipc_server_t* const server)
 {
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
+
+    if (ipc_fragment_writer_pending(&server->fragment_send) == 0 ||
+        ipc_fragment_writer_flush(&server->fragment_send, server->ring_send))
+    {
+        if (server->latest_send.count != 0)
+            ipc_latest_flush(&server->latest_send, server->ring_send);
+    }
+
+    if (ipc_server_backlog_size(server) != 0)
+        __ipc_stats_add(&shared_data->stats_server.commit_failures, 1);
+
     if (ipc_ring_commit(server->ring_send))
     {
-        ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
+        __ipc_stats_commit(&shared_data->stats_server, server->ring_send);
         ipc_sem_wake(&shared_data->sem_server);
+
+        // pairs with the fence in ipc_client_notify_rearm, either the client sees the new data or we see it rearmed
+        if (server->notify_send.wfd >= 0)
+        {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+            if (__sync_bool_compare_and_swap(&shared_data->notify_server_pending, 0, 1))
+                ipc_notify_wake(&server->notify_send);
+        }
+
         return true;
     }
 
     return false;
 }
 
+static inline
+uint32_t ipc_server_backlog_size(ipc_server_t* const server)
+{
+    return ipc_fragment_writer_pending(&server->fragment_send) + ipc_latest_pending(&server->latest_send);
+}
+
+static inline
+void ipc_server_set_write_policy(ipc_server_t* const server,
+                                 const uint32_t type,
+                                 const ipc_write_policy_t policy,
+                                 const uint32_t timeout_usecs)
+{
+    assert(type < IPC_WRITE_POLICY_TYPES);
+
+    if (type >= IPC_WRITE_POLICY_TYPES)
+        return;
+
+    server->write_policies[type].policy = policy;
+    server->write_policies[type].timeout_usecs = timeout_usecs;
+}
+
+static inline
+void ipc_server_get_stats(ipc_server_t* const server, ipc_stats_t* const send, ipc_stats_t* const recv)
+{
+    const ipc_shared_data_t* const shared_data = (const ipc_shared_data_t*)server->shm.ptr;
+
+    __ipc_stats_load(send, &shared_data->stats_server);
+    __ipc_stats_load(recv, &shared_data->stats_client);
+}
+
 static inline
 bool ipc_server_wait_secs(ipc_server_t* const server, const uint32_t secs)
 {
     ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
-    return ipc_sem_wait_secs(&shared_data->sem_client, secs);
+
+    if (! ipc_sem_wait_secs(&shared_data->sem_client, secs))
+        return false;
+
+    __ipc_stats_woken(&shared_data->stats_client);
+    return true;
+}
+
+static inline
+bool ipc_server_wait_usecs(ipc_server_t* const server, const uint32_t usecs)
+{
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
+
+    if (! ipc_sem_wait_usecs(&shared_data->sem_client, usecs))
+        return false;
+
+    __ipc_stats_woken(&shared_data->stats_client);
+    return true;
+}
+
+static inline
+int32_t ipc_server_notify_fd(ipc_server_t* const server)
+{
+    return server->notify_recv.rfd;
+}
+
+static inline
+void ipc_server_notify_clear(ipc_server_t* const server)
+{
+    if (server->notify_recv.rfd < 0)
+        return;
+
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)server->shm.ptr;
+
+    ipc_notify_clear(server->notify_recv.rfd);
+
+    // called on every host idle, only signaled wakeups say something about latency
+    if (__atomic_exchange_n(&shared_data->notify_client_pending, 0, __ATOMIC_SEQ_CST) != 0)
+        __ipc_stats_woken(&shared_data->stats_client);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 }
 
 // --------------------------------------------------------------------------------------------------------------------
 
 static inline
-ipc_client_t* ipc_client_attach(const char* const name, const uint32_t rbsize)
+ipc_client_t* ipc_client_attach(const char* const name)
 {
     ipc_client_t* const client = (ipc_client_t*)calloc(1, sizeof(ipc_client_t));
 
@@ -248,7 +1062,25 @@ ipc_client_t* ipc_client_attach(const char* const name, const uint32_t rbsize)
         return NULL;
     }
 
-    const uint32_t shared_data_size = sizeof(ipc_shared_data_t) + (sizeof(ipc_ring_t) + rbsize) * 2;
+    // the server side decides the ring size, find it out before mapping everything
+    if (! ipc_shm_client_attach(&client->shm, name, sizeof(ipc_shared_data_t), false))
+    {
+        fprintf(stderr, "[" IPC_LOG_NAME "] ipc_client_attach failed: could not attach shared memory segment\n");
+        free(client);
+        return NULL;
+    }
+
+    const uint32_t rbsize = ((const ipc_shared_data_t*)client->shm.ptr)->rbsize;
+    ipc_shm_client_dettach(&client->shm);
+
+    if (rbsize == 0 || rbsize % IPC_RING_MSG_ALIGN != 0)
+    {
+        fprintf(stderr, "[" IPC_LOG_NAME "] ipc_client_attach failed: invalid ring size\n");
+        free(client);
+        return NULL;
+    }
+
+    const uint32_t shared_data_size = sizeof(ipc_shared_data_t) + ipc_ring_alloc_size(rbsize) * 2;
 
     if (! ipc_shm_client_attach(&client->shm, name, shared_data_size, false))
     {
@@ -259,7 +1091,12 @@ ipc_client_t* ipc_client_attach(const char* const name, const uint32_t rbsize)
 
     ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)client->shm.ptr;
     client->ring_recv = (ipc_ring_t*)shared_data->rbdata;
-    client->ring_send = (ipc_ring_t*)(shared_data->rbdata + sizeof(ipc_ring_t) + rbsize);
+    client->ring_send = (ipc_ring_t*)(shared_data->rbdata + ipc_ring_alloc_size(rbsize));
+    strncpy(client->name, name, IPC_SHM_NAME_SIZE - 1);
+
+    // inherited from the server side, not owned by us
+    client->notify_send.rfd = -1;
+    client->notify_send.wfd = shared_data->notify_client_fd;
 
     // notify server we started ok
     ipc_sem_wake(&shared_data->sem_server);
@@ -270,46 +1107,198 @@ ipc_client_t* ipc_client_attach(const char* const name, const uint32_t rbsize)
 static inline
 void ipc_client_dettach(ipc_client_t* const client)
 {
+    ipc_overflow_writer_destroy(&client->overflow_send);
+    ipc_overflow_reader_destroy(&client->overflow_recv);
+    ipc_fragment_writer_destroy(&client->fragment_send);
+    ipc_fragment_reader_destroy(&client->fragment_recv);
     ipc_shm_client_dettach(&client->shm);
     free(client);
 }
 
 static inline
-bool ipc_client_read_size(const ipc_client_t* const client)
+uint32_t ipc_client_read_size(ipc_client_t* const client)
 {
     return ipc_ring_read_size(client->ring_recv);
 }
 
 static inline
-bool ipc_client_read(ipc_client_t* const client, void* const dst, const uint32_t size)
+bool ipc_client_write_msg(ipc_client_t* const client,
+                          const uint32_t type,
+                          const void* const header, const uint32_t header_size,
+                          const void* const payload, const uint32_t payload_size)
+{
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)client->shm.ptr;
+    const ipc_write_policy_config_t policy = __ipc_write_policy(client->write_policies, type);
+    const uint32_t size = header_size + payload_size;
+
+    // give the other side a chance to make room before giving up
+    if (policy.policy == ipc_write_policy_block && ! __ipc_write_is_large(client->ring_send, size))
+    {
+        // sleeps can take much longer than asked for (Sleep(1) on Windows), go by the real time
+        const uint64_t deadline = ipc_time_ns() + (uint64_t)policy.timeout_usecs * 1000;
+
+        while (! __ipc_write_has_room(client->ring_send, &client->fragment_send, size) && ipc_time_ns() < deadline)
+        {
+            ipc_client_commit(client);
+            __ipc_write_sleep();
+        }
+    }
+
+    ipc_stats_t* const stats = &shared_data->stats_client;
+
+    if (! __ipc_write_msg(client->ring_send, &client->overflow_send, &shared_data->overflow_client_busy,
+                          &client->fragment_send, &client->latest_send, stats,
+                          client->name, 'c', policy.policy, type, header, header_size, payload, payload_size))
+        return false;
+
+    __ipc_stats_add(&stats->messages, 1);
+    __ipc_stats_add(&stats->bytes, size);
+    return true;
+}
+
+static inline
+bool ipc_client_peek_msg(ipc_client_t* const client, ipc_ring_msg_t* const msg)
+{
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)client->shm.ptr;
+    return __ipc_peek_msg(client->ring_recv, &client->overflow_recv, &shared_data->overflow_server_busy,
+                          &client->fragment_recv, &shared_data->stats_server, client->name, 's', msg);
+}
+
+static inline
+void ipc_client_consume_msg(ipc_client_t* const client, const ipc_ring_msg_t* const msg, void* const dst)
+{
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)client->shm.ptr;
+    __ipc_consume_msg(client->ring_recv, &client->overflow_recv, &shared_data->overflow_server_busy, &client->fragment_recv, msg, dst);
+}
+
+static inline
+const uint8_t* ipc_client_acquire_msg(ipc_client_t* const client, ipc_ring_msg_t* const msg)
 {
-    return ipc_ring_read(client->ring_recv, dst, size);
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)client->shm.ptr;
+    return __ipc_acquire_msg(client->ring_recv, &client->overflow_recv, &shared_data->overflow_server_busy,
+                             &client->fragment_recv, &shared_data->stats_server, client->name, 's', msg);
 }
 
 static inline
-bool ipc_client_write(ipc_client_t* const client, const void* const src, const uint32_t size)
+void ipc_client_release_msgs(ipc_client_t* const client)
 {
-    return ipc_ring_write(client->ring_send, src, size);
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)client->shm.ptr;
+    __ipc_release_msgs(client->ring_recv, &client->overflow_recv, &shared_data->overflow_server_busy, &client->fragment_recv);
 }
 
 static inline
 bool ipc_client_commit(ipc_client_t* const client)
 {
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)client->shm.ptr;
+
+    if (ipc_fragment_writer_pending(&client->fragment_send) == 0 ||
+        ipc_fragment_writer_flush(&client->fragment_send, client->ring_send))
+    {
+        if (client->latest_send.count != 0)
+            ipc_latest_flush(&client->latest_send, client->ring_send);
+    }
+
+    if (ipc_client_backlog_size(client) != 0)
+        __ipc_stats_add(&shared_data->stats_client.commit_failures, 1);
+
     if (ipc_ring_commit(client->ring_send))
     {
-        ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)client->shm.ptr;
+        __ipc_stats_commit(&shared_data->stats_client, client->ring_send);
         ipc_sem_wake(&shared_data->sem_client);
+
+        // pairs with the fence in ipc_server_notify_clear
+        if (client->notify_send.wfd >= 0)
+        {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+            if (__sync_bool_compare_and_swap(&shared_data->notify_client_pending, 0, 1))
+                ipc_notify_wake(&client->notify_send);
+        }
+
         return true;
     }
 
     return false;
 }
 
+static inline
+uint32_t ipc_client_backlog_size(ipc_client_t* const client)
+{
+    return ipc_fragment_writer_pending(&client->fragment_send) + ipc_latest_pending(&client->latest_send);
+}
+
+static inline
+void ipc_client_set_write_policy(ipc_client_t* const client,
+                                 const uint32_t type,
+                                 const ipc_write_policy_t policy,
+                                 const uint32_t timeout_usecs)
+{
+    assert(type < IPC_WRITE_POLICY_TYPES);
+
+    if (type >= IPC_WRITE_POLICY_TYPES)
+        return;
+
+    client->write_policies[type].policy = policy;
+    client->write_policies[type].timeout_usecs = timeout_usecs;
+}
+
+static inline
+void ipc_client_get_stats(ipc_client_t* const client, ipc_stats_t* const send, ipc_stats_t* const recv)
+{
+    const ipc_shared_data_t* const shared_data = (const ipc_shared_data_t*)client->shm.ptr;
+
+    __ipc_stats_load(send, &shared_data->stats_client);
+    __ipc_stats_load(recv, &shared_data->stats_server);
+}
+
+static inline
+void ipc_client_count_roundtrip(ipc_client_t* const client)
+{
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)client->shm.ptr;
+    __ipc_stats_add(&shared_data->stats_client.roundtrips, 1);
+}
+
 static inline
 bool ipc_client_wait_secs(ipc_client_t* const client, const uint32_t secs)
 {
     ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)client->shm.ptr;
-    return ipc_sem_wait_secs(&shared_data->sem_server, secs);
+
+    if (! ipc_sem_wait_secs(&shared_data->sem_server, secs))
+        return false;
+
+    __ipc_stats_woken(&shared_data->stats_server);
+    return true;
+}
+
+static inline
+bool ipc_client_wait_usecs(ipc_client_t* const client, const uint32_t usecs)
+{
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)client->shm.ptr;
+
+    if (! ipc_sem_wait_usecs(&shared_data->sem_server, usecs))
+        return false;
+
+    __ipc_stats_woken(&shared_data->stats_server);
+    return true;
+}
+
+static inline
+int32_t ipc_client_notify_fd(ipc_client_t* const client)
+{
+    const ipc_shared_data_t* const shared_data = (const ipc_shared_data_t*)client->shm.ptr;
+    return shared_data->notify_server_fd;
+}
+
+static inline
+void ipc_client_notify_rearm(ipc_client_t* const client)
+{
+    ipc_shared_data_t* const shared_data = (ipc_shared_data_t*)client->shm.ptr;
+
+    // shared mode rearms every bridge on any wakeup, only signaled ones say something about latency
+    if (__atomic_exchange_n(&shared_data->notify_server_pending, 0, __ATOMIC_SEQ_CST) != 0)
+        __ipc_stats_woken(&shared_data->stats_server);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 }
 
 // --------------------------------------------------------------------------------------------------------------------
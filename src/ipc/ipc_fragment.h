@@ -0,0 +1,294 @@
+// Copyright 2024 Filipe Coelho <falktx@falktx.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#ifndef IPC_LOG_NAME
+ #define IPC_LOG_NAME "ipc"
+#endif
+
+#include "ipc_ring.h"
+
+#ifdef __cplusplus
+ #include <cstdlib>
+#else
+ #include <stdlib.h>
+#endif
+
+// messages that do not fit in the ring right now can be queued in private memory and written over the next commits.
+// queued messages are written whole if they fit in half the ring, otherwise they are split into fragments.
+// the consumer reassembles fragments before handing out the message.
+
+// ring message type used for fragments, its payload is a ipc_fragment_t followed by a piece of the message
+#define IPC_RING_MSG_FRAGMENT (UINT32_MAX - 2)
+
+#define IPC_FRAGMENT_MAX_SIZE 0x4000000
+
+typedef struct {
+    uint32_t type, size, offset, seq;
+} ipc_fragment_t;
+
+// producer side, queue of framed messages waiting for room in the ring
+typedef struct {
+    uint8_t* data;
+    uint32_t capacity;
+    // start of the first queued message and end of the last one
+    uint32_t head, used;
+    // amount of the first message written so far, and sequence number of its fragments
+    uint32_t sent, seq;
+} ipc_fragment_writer_t;
+
+// consumer side
+typedef struct {
+    uint8_t* data;
+    uint32_t capacity;
+    uint32_t type, size, received, seq;
+    // message fully received through peek, waiting for consume
+    bool complete;
+    // message handed out through acquire, its buffer must stay valid until release
+    bool acquired;
+    // buffers of handed out messages replaced by a newer one, freed on release
+    void* retired;
+} ipc_fragment_reader_t;
+
+// buffers keep a link in front of the data, so that they can be retired without copying
+#define IPC_FRAGMENT_LINK_SIZE 8
+
+static inline
+uint32_t __ipc_fragment_chunk_size(const ipc_ring_t* const ring)
+{
+    // at most half the ring, so a fragment always fits once the consumer catches up
+    const uint32_t overhead = sizeof(ipc_ring_msg_t) + sizeof(ipc_fragment_t);
+
+    if (ring->size / 2 <= overhead)
+        return 0;
+
+    return (ring->size / 2 - overhead) & ~(uint32_t)(IPC_RING_MSG_ALIGN - 1);
+}
+
+static inline
+uint32_t ipc_fragment_writer_pending(const ipc_fragment_writer_t* const writer)
+{
+    return writer->used - writer->head;
+}
+
+// write as much of the queue as fits right now, returns true once it is empty
+static inline
+bool ipc_fragment_writer_flush(ipc_fragment_writer_t* const writer, ipc_ring_t* const ring)
+{
+    const uint32_t chunk_size = __ipc_fragment_chunk_size(ring);
+
+    while (writer->head != writer->used)
+    {
+        ipc_ring_msg_t msg;
+        memcpy(&msg, writer->data + writer->head, sizeof(ipc_ring_msg_t));
+
+        const uint8_t* const payload = writer->data + writer->head + sizeof(ipc_ring_msg_t);
+
+        if (writer->sent == 0 && msg.size <= chunk_size)
+        {
+            if (! ipc_ring_can_write_msg(ring, msg.size))
+                return false;
+
+            ipc_ring_write_msg(ring, msg.type, NULL, 0, payload, msg.size);
+            writer->sent = msg.size;
+        }
+        else
+        {
+            const uint32_t remaining = msg.size - writer->sent;
+            const uint32_t size = remaining < chunk_size ? remaining : chunk_size;
+
+            if (! ipc_ring_can_write_msg(ring, sizeof(ipc_fragment_t) + size))
+                return false;
+
+            if (writer->sent == 0)
+                ++writer->seq;
+
+            const ipc_fragment_t fragment = { msg.type, msg.size, writer->sent, writer->seq };
+            ipc_ring_write_msg(ring, IPC_RING_MSG_FRAGMENT, &fragment, sizeof(fragment), payload + writer->sent, size);
+
+            writer->sent += size;
+        }
+
+        if (writer->sent == msg.size)
+        {
+            writer->head += __ipc_ring_msg_size(msg.size);
+            writer->sent = 0;
+        }
+    }
+
+    writer->head = writer->used = 0;
+    return true;
+}
+
+// queue a copy of a message after any others still waiting, and write whatever fits right now
+static inline
+bool ipc_fragment_write_msg(ipc_fragment_writer_t* const writer,
+                            ipc_ring_t* const ring,
+                            const uint32_t type,
+                            const void* const header, const uint32_t header_size,
+                            const void* const payload, const uint32_t payload_size)
+{
+    const uint32_t size = header_size + payload_size;
+
+    if (size > IPC_FRAGMENT_MAX_SIZE || ipc_fragment_writer_pending(writer) > IPC_FRAGMENT_MAX_SIZE - size)
+        return false;
+
+    // too small of a ring for fragments
+    if (size > __ipc_fragment_chunk_size(ring) && __ipc_fragment_chunk_size(ring) < IPC_RING_MSG_ALIGN)
+        return false;
+
+    // reclaim space of messages written already
+    if (writer->head != 0)
+    {
+        memmove(writer->data, writer->data + writer->head, writer->used - writer->head);
+        writer->used -= writer->head;
+        writer->head = 0;
+    }
+
+    const uint32_t msg_size = __ipc_ring_msg_size(size);
+
+    if (writer->used + msg_size > writer->capacity)
+    {
+        uint32_t capacity = writer->capacity != 0 ? writer->capacity : 0x1000;
+        while (capacity < writer->used + msg_size)
+            capacity *= 2;
+
+        uint8_t* const data = (uint8_t*)realloc(writer->data, capacity);
+        if (data == NULL)
+        {
+            fprintf(stderr, "[" IPC_LOG_NAME "] ipc_fragment_write_msg failed: out of memory\n");
+            return false;
+        }
+
+        writer->data = data;
+        writer->capacity = capacity;
+    }
+
+    const ipc_ring_msg_t msg = { type, size };
+    uint8_t* const ptr = writer->data + writer->used;
+    memcpy(ptr, &msg, sizeof(ipc_ring_msg_t));
+
+    if (header_size != 0)
+        memcpy(ptr + sizeof(ipc_ring_msg_t), header, header_size);
+
+    if (payload_size != 0)
+        memcpy(ptr + sizeof(ipc_ring_msg_t) + header_size, payload, payload_size);
+
+    writer->used += msg_size;
+
+    ipc_fragment_writer_flush(writer, ring);
+    return true;
+}
+
+static inline
+void ipc_fragment_writer_destroy(ipc_fragment_writer_t* const writer)
+{
+    free(writer->data);
+    writer->data = NULL;
+    writer->capacity = writer->head = writer->used = writer->sent = 0;
+}
+
+static inline
+uint8_t* __ipc_fragment_reader_alloc(ipc_fragment_reader_t* const reader, const uint32_t size)
+{
+    if (reader->acquired && reader->data != NULL)
+    {
+        void* const link = reader->data - IPC_FRAGMENT_LINK_SIZE;
+        memcpy(link, &reader->retired, sizeof(void*));
+        reader->retired = link;
+        reader->data = NULL;
+        reader->capacity = 0;
+        reader->acquired = false;
+    }
+
+    if (size > reader->capacity)
+    {
+        uint8_t* const link = reader->data != NULL ? reader->data - IPC_FRAGMENT_LINK_SIZE : NULL;
+        uint8_t* const block = (uint8_t*)realloc(link, IPC_FRAGMENT_LINK_SIZE + size);
+        if (block == NULL)
+            return NULL;
+
+        reader->data = block + IPC_FRAGMENT_LINK_SIZE;
+        reader->capacity = size;
+    }
+
+    return reader->data;
+}
+
+// take in a fragment read from the ring.
+// returns 1 and sets `msg` once the whole message is received, 0 if more fragments are needed, -1 if invalid.
+static inline
+int ipc_fragment_read(ipc_fragment_reader_t* const reader, ipc_ring_msg_t* const msg, const uint8_t* const data)
+{
+    ipc_fragment_t fragment;
+
+    if (msg->size <= sizeof(fragment))
+        return -1;
+
+    memcpy(&fragment, data, sizeof(fragment));
+
+    const uint32_t size = msg->size - sizeof(fragment);
+
+    if (fragment.offset == 0)
+    {
+        if (fragment.size == 0 || fragment.size > IPC_FRAGMENT_MAX_SIZE)
+            return -1;
+
+        if (__ipc_fragment_reader_alloc(reader, fragment.size) == NULL)
+        {
+            fprintf(stderr, "[" IPC_LOG_NAME "] ipc_fragment_read failed: out of memory\n");
+            return -1;
+        }
+
+        reader->type = fragment.type;
+        reader->size = fragment.size;
+        reader->received = 0;
+        reader->seq = fragment.seq;
+    }
+    else if (fragment.seq != reader->seq || fragment.type != reader->type ||
+             fragment.size != reader->size || fragment.offset != reader->received)
+    {
+        return -1;
+    }
+
+    if (size > reader->size - reader->received)
+        return -1;
+
+    memcpy(reader->data + reader->received, data + sizeof(fragment), size);
+    reader->received += size;
+
+    if (reader->received != reader->size)
+        return 0;
+
+    msg->type = reader->type;
+    msg->size = reader->size;
+    return 1;
+}
+
+// free buffers of messages handed out before the last release
+static inline
+void ipc_fragment_reader_release(ipc_fragment_reader_t* const reader)
+{
+    reader->acquired = false;
+
+    while (reader->retired != NULL)
+    {
+        void* const link = reader->retired;
+        memcpy(&reader->retired, link, sizeof(void*));
+        free(link);
+    }
+}
+
+static inline
+void ipc_fragment_reader_destroy(ipc_fragment_reader_t* const reader)
+{
+    ipc_fragment_reader_release(reader);
+
+    if (reader->data != NULL)
+        free(reader->data - IPC_FRAGMENT_LINK_SIZE);
+
+    reader->data = NULL;
+    reader->capacity = reader->size = reader->received = 0;
+    reader->complete = false;
+}
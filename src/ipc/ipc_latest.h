@@ -0,0 +1,146 @@
+// Copyright 2024 Filipe Coelho <falktx@falktx.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#include "ipc_ring.h"
+
+// small messages waiting for room in the ring where only the latest one matters, like meter values.
+// messages are matched by type and key, a newer one replaces the older in place.
+
+#define IPC_LATEST_SLOTS 32
+#define IPC_LATEST_DATA_SIZE 56
+
+typedef struct {
+    IPC_ALIGNAS(IPC_RING_MSG_ALIGN) uint8_t data[IPC_LATEST_DATA_SIZE];
+    uint32_t type, key, size;
+    bool used;
+} ipc_latest_slot_t;
+
+typedef struct {
+    ipc_latest_slot_t slots[IPC_LATEST_SLOTS];
+    uint32_t count;
+} ipc_latest_t;
+
+// first word of the header, e.g. a port index
+static inline
+uint32_t ipc_latest_key(const void* const header, const uint32_t header_size)
+{
+    uint32_t key = 0;
+
+    if (header_size >= sizeof(uint32_t))
+        memcpy(&key, header, sizeof(uint32_t));
+
+    return key;
+}
+
+static inline
+ipc_latest_slot_t* __ipc_latest_find(ipc_latest_t* const latest, const uint32_t type, const uint32_t key)
+{
+    if (latest->count == 0)
+        return NULL;
+
+    for (uint32_t i = 0; i < IPC_LATEST_SLOTS; ++i)
+    {
+        ipc_latest_slot_t* const slot = &latest->slots[i];
+
+        if (slot->used && slot->type == type && slot->key == key)
+            return slot;
+    }
+
+    return NULL;
+}
+
+// keep a copy of a message, replacing an older one with the same type and key.
+// returns false if it does not fit, sets `replaced` if an older message was dropped.
+static inline
+bool ipc_latest_store(ipc_latest_t* const latest,
+                      const uint32_t type, const uint32_t key,
+                      const void* const header, const uint32_t header_size,
+                      const void* const payload, const uint32_t payload_size,
+                      bool* const replaced)
+{
+    if (header_size + payload_size > IPC_LATEST_DATA_SIZE)
+        return false;
+
+    ipc_latest_slot_t* slot = __ipc_latest_find(latest, type, key);
+    *replaced = slot != NULL;
+
+    if (slot == NULL)
+    {
+        for (uint32_t i = 0; i < IPC_LATEST_SLOTS && slot == NULL; ++i)
+        {
+            if (! latest->slots[i].used)
+                slot = &latest->slots[i];
+        }
+
+        if (slot == NULL)
+            return false;
+
+        slot->type = type;
+        slot->key = key;
+        slot->used = true;
+        ++latest->count;
+    }
+
+    if (header_size != 0)
+        memcpy(slot->data, header, header_size);
+
+    if (payload_size != 0)
+        memcpy(slot->data + header_size, payload, payload_size);
+
+    slot->size = header_size + payload_size;
+    return true;
+}
+
+// forget a message that is outdated, returns true if there was one
+static inline
+bool ipc_latest_remove(ipc_latest_t* const latest, const uint32_t type, const uint32_t key)
+{
+    ipc_latest_slot_t* const slot = __ipc_latest_find(latest, type, key);
+
+    if (slot == NULL)
+        return false;
+
+    slot->used = false;
+    --latest->count;
+    return true;
+}
+
+static inline
+uint32_t ipc_latest_pending(const ipc_latest_t* const latest)
+{
+    if (latest->count == 0)
+        return 0;
+
+    uint32_t size = 0;
+    for (uint32_t i = 0; i < IPC_LATEST_SLOTS; ++i)
+    {
+        if (latest->slots[i].used)
+            size += latest->slots[i].size;
+    }
+
+    return size;
+}
+
+// write as many kept messages as fit right now, returns true once none are left
+static inline
+bool ipc_latest_flush(ipc_latest_t* const latest, ipc_ring_t* const ring)
+{
+    for (uint32_t i = 0; i < IPC_LATEST_SLOTS && latest->count != 0; ++i)
+    {
+        ipc_latest_slot_t* const slot = &latest->slots[i];
+
+        if (! slot->used)
+            continue;
+
+        if (! ipc_ring_can_write_msg(ring, slot->size))
+            return false;
+
+        ipc_ring_write_msg(ring, slot->type, NULL, 0, slot->data, slot->size);
+        slot->used = false;
+        --latest->count;
+    }
+
+    return true;
+}
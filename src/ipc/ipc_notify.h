@@ -0,0 +1,149 @@
+// Copyright 2024 Filipe Coelho <falktx@falktx.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#ifndef IPC_LOG_NAME
+ #define IPC_LOG_NAME "ipc"
+#endif
+
+#ifdef __cplusplus
+ #include <cstdint>
+ #include <cstdio>
+#else
+ #define _GNU_SOURCE
+ #include <stdbool.h>
+ #include <stdint.h>
+ #include <stdio.h>
+#endif
+
+#ifndef _WIN32
+ #ifdef __cplusplus
+  #include <cerrno>
+  #include <cstring>
+ #else
+  #include <errno.h>
+  #include <string.h>
+ #endif
+ #include <fcntl.h>
+ #include <unistd.h>
+ #ifdef __linux__
+  #include <sys/eventfd.h>
+ #endif
+#endif
+
+// pollable wakeup handle, meant to be integrated in event loops.
+// eventfd on Linux (both fds are the same), a pipe on other POSIX systems, unsupported on Windows.
+// created with close-on-exec, see ipc_proc_start for passing it to a child process.
+typedef struct {
+    int32_t rfd, wfd;
+} ipc_notify_t;
+
+static inline
+bool ipc_notify_create(ipc_notify_t* const notify)
+{
+    notify->rfd = notify->wfd = -1;
+
+   #if defined(_WIN32)
+    return false;
+   #elif defined(__linux__)
+    const int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0)
+    {
+        fprintf(stderr, "[" IPC_LOG_NAME "] eventfd failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    notify->rfd = notify->wfd = fd;
+    return true;
+   #else
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        fprintf(stderr, "[" IPC_LOG_NAME "] pipe failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < 2; ++i)
+    {
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    }
+
+    notify->rfd = fds[0];
+    notify->wfd = fds[1];
+    return true;
+   #endif
+}
+
+// duplicate the writing side, for when several users wake up the same process
+static inline
+bool ipc_notify_dup(ipc_notify_t* const notify, const ipc_notify_t* const other)
+{
+    notify->rfd = notify->wfd = -1;
+
+   #ifdef _WIN32
+    (void)other;
+    return false;
+   #else
+    if (other->wfd < 0)
+        return false;
+
+    notify->wfd = fcntl(other->wfd, F_DUPFD_CLOEXEC, 0);
+    return notify->wfd >= 0;
+   #endif
+}
+
+static inline
+void ipc_notify_destroy(ipc_notify_t* const notify)
+{
+   #ifndef _WIN32
+    if (notify->rfd >= 0 && notify->rfd != notify->wfd)
+        close(notify->rfd);
+    if (notify->wfd >= 0)
+        close(notify->wfd);
+   #endif
+
+    notify->rfd = notify->wfd = -1;
+}
+
+static inline
+void ipc_notify_wake(const ipc_notify_t* const notify)
+{
+   #if defined(_WIN32)
+    (void)notify;
+   #else
+    if (notify->wfd < 0)
+        return;
+
+    #ifdef __linux__
+    const uint64_t value = 1;
+    #else
+    const uint8_t value = 1;
+    #endif
+
+    while (write(notify->wfd, &value, sizeof(value)) < 0 && errno == EINTR) {}
+   #endif
+}
+
+// read out all pending wakeups, without blocking
+static inline
+void ipc_notify_clear(const int32_t rfd)
+{
+   #if defined(_WIN32)
+    (void)rfd;
+   #elif defined(__linux__)
+    if (rfd < 0)
+        return;
+
+    // eventfd reads always get the whole counter
+    uint64_t value;
+    while (read(rfd, &value, sizeof(value)) < 0 && errno == EINTR) {}
+   #else
+    if (rfd < 0)
+        return;
+
+    uint8_t values[64];
+    for (ssize_t r; (r = read(rfd, values, sizeof(values))) > 0 || (r < 0 && errno == EINTR);) {}
+   #endif
+}
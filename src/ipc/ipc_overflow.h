@@ -0,0 +1,179 @@
+// Copyright 2024 Filipe Coelho <falktx@falktx.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#ifndef IPC_LOG_NAME
+ #define IPC_LOG_NAME "ipc"
+#endif
+
+#include "ipc_ring.h"
+#include "ipc_shm.h"
+
+// side channel for messages too large for the ring.
+// the payload goes into a separate shared memory region owned by the producer, the ring only carries a reference to it.
+// the region holds one message at a time and is replaced by a bigger one when needed, each with a new generation name.
+// the consumer maps a region the first time it sees a reference to it, and unlinks its name right away.
+
+// ring message type used for references, its payload is a ipc_overflow_ref_t
+#define IPC_RING_MSG_OVERFLOW (UINT32_MAX - 1)
+
+// messages bigger than this fraction of the ring go through the side channel if possible
+#define IPC_OVERFLOW_RING_FRACTION 4
+
+#define IPC_OVERFLOW_MIN_SIZE 0x10000
+#define IPC_OVERFLOW_MAX_SIZE 0x4000000
+
+// values of the `busy` flag shared by both sides
+#define IPC_OVERFLOW_IDLE 0
+#define IPC_OVERFLOW_BUSY 1
+// the consumer could not map the current region, the producer switches to a new one
+#define IPC_OVERFLOW_LOST 2
+
+typedef struct {
+    uint32_t type, size, generation, capacity;
+} ipc_overflow_ref_t;
+
+// producer side
+typedef struct {
+    ipc_shm_server_t shm;
+    uint32_t generation, capacity;
+} ipc_overflow_writer_t;
+
+// consumer side
+typedef struct {
+    ipc_shm_client_t shm;
+    uint32_t generation, capacity;
+    // reference currently peeked, for giving back its ring space on consume
+    ipc_ring_msg_t ring_msg;
+    bool peeked, acquired;
+} ipc_overflow_reader_t;
+
+static inline
+void ipc_overflow_writer_destroy(ipc_overflow_writer_t* const writer)
+{
+    if (writer->shm.ptr != NULL)
+        ipc_shm_server_destroy(&writer->shm);
+
+    writer->shm.ptr = NULL;
+    writer->capacity = 0;
+}
+
+static inline
+void ipc_overflow_reader_destroy(ipc_overflow_reader_t* const reader)
+{
+    if (reader->shm.ptr != NULL)
+        ipc_shm_client_dettach(&reader->shm);
+
+    reader->shm.ptr = NULL;
+    reader->capacity = 0;
+}
+
+// store a message in the side channel and write a reference to it in the ring.
+// `busy` is shared with the consumer, set while it has not taken the previous message yet.
+// returns false if the side channel cannot be used right now, in which case nothing was written.
+static inline
+bool ipc_overflow_write_msg(ipc_overflow_writer_t* const writer,
+                            uint32_t* const busy,
+                            ipc_ring_t* const ring,
+                            const char* const name, const char dir,
+                            const uint32_t type,
+                            const void* const header, const uint32_t header_size,
+                            const void* const payload, const uint32_t payload_size)
+{
+    const uint32_t size = header_size + payload_size;
+    const uint32_t state = __atomic_load_n(busy, __ATOMIC_ACQUIRE);
+
+    if (size > IPC_OVERFLOW_MAX_SIZE || state == IPC_OVERFLOW_BUSY)
+        return false;
+
+    // its name may be gone already, a new region gets a new generation name
+    if (state == IPC_OVERFLOW_LOST)
+    {
+        ipc_overflow_writer_destroy(writer);
+        __atomic_store_n(busy, IPC_OVERFLOW_IDLE, __ATOMIC_RELAXED);
+    }
+
+    if (size > writer->capacity)
+    {
+        uint32_t capacity = IPC_OVERFLOW_MIN_SIZE;
+        while (capacity < size)
+            capacity *= 2;
+
+        // not busy, so the consumer is done with the old region
+        ipc_overflow_writer_destroy(writer);
+
+        char shmname[IPC_SHM_NAME_SIZE];
+
+        if (! ipc_shm_name_derive(shmname, name, dir, ++writer->generation) ||
+            ! ipc_shm_server_create(&writer->shm, shmname, capacity, false))
+        {
+            writer->shm.ptr = NULL;
+            return false;
+        }
+
+        writer->capacity = capacity;
+    }
+
+    if (header_size != 0)
+        memcpy(writer->shm.ptr, header, header_size);
+
+    if (payload_size != 0)
+        memcpy(writer->shm.ptr + header_size, payload, payload_size);
+
+    const ipc_overflow_ref_t ref = { type, size, writer->generation, writer->capacity };
+
+    if (! ipc_ring_write_msg(ring, IPC_RING_MSG_OVERFLOW, &ref, sizeof(ref), NULL, 0))
+        return false;
+
+    // published together with the reference on commit
+    __atomic_store_n(busy, IPC_OVERFLOW_BUSY, __ATOMIC_RELAXED);
+    return true;
+}
+
+// turn a reference read from the ring into the message it points to, mapping its region if needed.
+// on failure `msg` is left untouched, so callers treat it as an unknown message.
+static inline
+const uint8_t* ipc_overflow_resolve(ipc_overflow_reader_t* const reader,
+                                    const char* const name, const char dir,
+                                    ipc_ring_msg_t* const msg, const uint8_t* const data)
+{
+    ipc_overflow_ref_t ref;
+
+    if (msg->size != sizeof(ref))
+        return NULL;
+
+    memcpy(&ref, data, sizeof(ref));
+
+    if (ref.size > ref.capacity || ref.capacity > IPC_OVERFLOW_MAX_SIZE)
+        return NULL;
+
+    if (reader->shm.ptr == NULL || reader->generation != ref.generation || reader->capacity != ref.capacity)
+    {
+        ipc_overflow_reader_destroy(reader);
+
+        if (! ipc_shm_client_attach_private(&reader->shm, name, dir, ref.generation, ref.capacity))
+            return NULL;
+
+        reader->generation = ref.generation;
+        reader->capacity = ref.capacity;
+    }
+
+    msg->type = ref.type;
+    msg->size = ref.size;
+    return reader->shm.ptr;
+}
+
+// let the producer reuse the side channel
+static inline
+void ipc_overflow_done(uint32_t* const busy)
+{
+    __atomic_store_n(busy, IPC_OVERFLOW_IDLE, __ATOMIC_RELEASE);
+}
+
+// let the producer reuse the side channel after a reference could not be resolved
+static inline
+void ipc_overflow_lost(uint32_t* const busy)
+{
+    __atomic_store_n(busy, IPC_OVERFLOW_LOST, __ATOMIC_RELEASE);
+}
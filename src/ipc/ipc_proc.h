@@ -31,6 +31,7 @@
   #include <errno.h>
   #include <string.h>
  #endif
+ #include <fcntl.h>
  #include <signal.h>
  #include <unistd.h>
  #include <sys/wait.h>
@@ -44,8 +45,10 @@ typedef struct {
    #endif
 } ipc_proc_t;
 
+// `inherit_fds` is an optional list terminated by -1, with close-on-exec file descriptors to be kept open
+// in the new process only, at the same numbers. ignored on Windows, where inheritable handles are always passed.
 static inline
-ipc_proc_t* ipc_proc_start(const char* const args[])
+ipc_proc_t* ipc_proc_start(const char* const args[], const int32_t* const inherit_fds)
 {
     /*
    #ifdef _WIN32
@@ -112,6 +115,7 @@ ipc_proc_t* ipc_proc_start(const char* const args[])
     *cmdptr = 0;
 
     fprintf(stderr, "[" IPC_LOG_NAME "] ipc_proc_start trying to launch '%ls'\n", cmd);
+    (void)inherit_fds;
 
     STARTUPINFOW si = IPC_STRUCT_INIT;
     si.cb = sizeof(si);
@@ -132,6 +136,10 @@ ipc_proc_t* ipc_proc_start(const char* const args[])
     {
     // child process
     case 0:
+        // the child has its own descriptor table, other processes spawned by the parent do not get these
+        for (int i = 0; inherit_fds != NULL && inherit_fds[i] >= 0; ++i)
+            fcntl(inherit_fds[i], F_SETFD, 0);
+
         execvp(args[0], (char* const*)args);
         fprintf(stderr, "[" IPC_LOG_NAME "] exec failed: %s\n", strerror(errno));
         _exit(1);
@@ -8,172 +8,286 @@
 #endif
 
 #ifdef __cplusplus
+ #define IPC_ALIGNAS(x) alignas(x)
  #include <cassert>
  #include <cstdint>
+ #include <cstdio>
  #include <cstring>
 #else
+ #define IPC_ALIGNAS(x) _Alignas(x)
  #define _GNU_SOURCE
  #include <assert.h>
  #include <stdbool.h>
  #include <stdint.h>
+ #include <stdio.h>
  #include <string.h>
 #endif
 
+#define IPC_CACHELINE_SIZE 64
+
+// ring indices are shared between processes, so std::atomic/_Atomic cannot be used on them directly
+#define ipc_atomic_load_acquire(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define ipc_atomic_store_release(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
 typedef enum {
-    ipc_ring_flag_invalidate_commit = 0x1,
-    ipc_ring_flag_error_reading = 0x2,
-    ipc_ring_flag_error_writing = 0x4,
+    ipc_ring_flag_error_reading = 0x1,
+    ipc_ring_flag_error_writing = 0x2,
 } ipc_ring_flag_t;
 
+// single-producer single-consumer ring of framed messages, each side owns a cache line
 typedef struct {
-  uint32_t size, head, tail, wrtn, flags;
-  uint8_t buffer[];
+  // constant after init
+  IPC_ALIGNAS(IPC_CACHELINE_SIZE) uint32_t size;
+
+  // producer side: committed and pending write positions, last seen tail
+  IPC_ALIGNAS(IPC_CACHELINE_SIZE) uint32_t head;
+  uint32_t wrtn, tail_cache, wflags;
+
+  // consumer side: released and pending read positions, last seen head
+  IPC_ALIGNAS(IPC_CACHELINE_SIZE) uint32_t tail;
+  uint32_t rdtn, head_cache, rflags;
+
+  IPC_ALIGNAS(IPC_CACHELINE_SIZE) uint8_t buffer[];
 } ipc_ring_t;
 
+// fixed header in front of every framed message, followed by `size` bytes of payload
+typedef struct {
+  uint32_t type, size;
+} ipc_ring_msg_t;
+
+// messages never wrap around, the space left at the end of the buffer is skipped with a padding message
+#define IPC_RING_MSG_PADDING UINT32_MAX
+
+// messages start on 8-byte boundaries, so payloads can be used in place (e.g. as LV2 atoms)
+#define IPC_RING_MSG_ALIGN 8
+
+static inline
+uint32_t __ipc_ring_msg_size(uint32_t size)
+{
+    return (sizeof(ipc_ring_msg_t) + size + IPC_RING_MSG_ALIGN - 1) & ~(uint32_t)(IPC_RING_MSG_ALIGN - 1);
+}
+
+// amount of memory used by a ring of `size` bytes, keeping anything placed after it cache-line aligned
+static inline
+uint32_t ipc_ring_alloc_size(uint32_t size)
+{
+    return sizeof(ipc_ring_t) + ((size + IPC_CACHELINE_SIZE - 1) & ~(uint32_t)(IPC_CACHELINE_SIZE - 1));
+}
+
 static inline
 void ipc_ring_init(ipc_ring_t* ring, uint32_t size)
 {
+    assert(size % IPC_RING_MSG_ALIGN == 0);
+
     memset(ring, 0, sizeof(ipc_ring_t) + size);
     ring->size = size;
 }
 
 static inline
-uint32_t ipc_ring_read_size(const ipc_ring_t* const ring)
+uint32_t __ipc_ring_used(const ipc_ring_t* ring, uint32_t head, uint32_t tail)
+{
+    const uint32_t wrap = head >= tail ? 0 : ring->size;
+    return wrap + head - tail;
+}
+
+static inline
+uint32_t __ipc_ring_free(const ipc_ring_t* ring, uint32_t tail, uint32_t wrtn)
 {
-    const uint32_t wrap = ring->head >= ring->tail ? 0 : ring->size;
-    return wrap + ring->head - ring->tail;
+    const uint32_t wrap = tail > wrtn ? 0 : ring->size;
+    return wrap + tail - wrtn - 1;
 }
 
+// consumer side, only touches the shared head if the cached copy is not enough
 static inline
-uint32_t ipc_ring_write_size(const ipc_ring_t* const ring)
+bool __ipc_ring_can_read(ipc_ring_t* ring, uint32_t size)
 {
-    const uint32_t wrap = ring->tail > ring->wrtn ? 0 : ring->size;
-    return wrap + ring->tail - ring->wrtn - 1;
+    if (__ipc_ring_used(ring, ring->head_cache, ring->rdtn) >= size)
+        return true;
+
+    ring->head_cache = ipc_atomic_load_acquire(&ring->head);
+    return __ipc_ring_used(ring, ring->head_cache, ring->rdtn) >= size;
 }
 
+// producer side, only touches the shared tail if the cached copy is not enough
 static inline
-bool ipc_ring_read(ipc_ring_t* ring, void* dst, uint32_t size)
+bool __ipc_ring_can_write(ipc_ring_t* ring, uint32_t size)
 {
-    assert(dst != NULL);
-    assert(size != 0);
-    assert(size < ring->size);
+    if (__ipc_ring_free(ring, ring->tail_cache, ring->wrtn) >= size)
+        return true;
 
-    // empty
-    if (ring->head == ring->tail)
-        return false;
+    ring->tail_cache = ipc_atomic_load_acquire(&ring->tail);
+    return __ipc_ring_free(ring, ring->tail_cache, ring->wrtn) >= size;
+}
 
-    uint8_t* const dstbuffer = (uint8_t*)dst;
+static inline
+uint32_t ipc_ring_read_size(ipc_ring_t* const ring)
+{
+    ring->head_cache = ipc_atomic_load_acquire(&ring->head);
+    return __ipc_ring_used(ring, ring->head_cache, ring->rdtn);
+}
 
-    const uint32_t head = ring->head;
-    const uint32_t tail = ring->tail;
-    const uint32_t wrap = head > tail ? 0 : ring->size;
+static inline
+uint32_t ipc_ring_write_size(ipc_ring_t* const ring)
+{
+    ring->tail_cache = ipc_atomic_load_acquire(&ring->tail);
+    return __ipc_ring_free(ring, ring->tail_cache, ring->wrtn);
+}
 
-    if (size > wrap + head - tail)
+// check if a message with `size` bytes of payload can be written right now, without logging errors
+static inline
+bool ipc_ring_can_write_msg(ipc_ring_t* ring, uint32_t size)
+{
+    const uint32_t msg_size = __ipc_ring_msg_size(size);
+    const uint32_t tillend = ring->size - ring->wrtn;
+
+    // space for the whole message at once, plus padding until the end of the buffer if needed
+    return msg_size < ring->size && __ipc_ring_can_write(ring, msg_size > tillend ? tillend + msg_size : msg_size);
+}
+
+static inline
+bool ipc_ring_write_msg(ipc_ring_t* ring,
+                        uint32_t type,
+                        const void* header, uint32_t header_size,
+                        const void* payload, uint32_t payload_size)
+{
+    assert(type != IPC_RING_MSG_PADDING);
+    assert(header != NULL || header_size == 0);
+    assert(payload != NULL || payload_size == 0);
+
+    const ipc_ring_msg_t msg = { type, header_size + payload_size };
+    const uint32_t size = __ipc_ring_msg_size(msg.size);
+
+    uint32_t wrtn = ring->wrtn;
+    const uint32_t tillend = ring->size - wrtn;
+    const bool wrap = size > tillend;
+
+    // not an error as such, ipc.h decides what to do and keeps count
+    if (! ipc_ring_can_write_msg(ring, msg.size))
     {
-        if ((ring->flags & ipc_ring_flag_error_reading) == 0)
-        {
-            ring->flags |= ipc_ring_flag_error_reading;
-            fprintf(stderr, "[" IPC_LOG_NAME "] ipc_ring_read failed: not enough space\n");
-        }
+        ring->wflags |= ipc_ring_flag_error_writing;
         return false;
     }
 
-    uint32_t readto = tail + size;
-
-    if (readto > ring->size)
+    if (wrap)
     {
-        readto -= ring->size;
-
-        if (size == 1)
-        {
-            memcpy(dstbuffer, ring->buffer + tail, 1);
-        }
-        else
-        {
-            const uint32_t firstpart = ring->size - tail;
-            memcpy(dstbuffer, ring->buffer + tail, firstpart);
-            memcpy(dstbuffer + firstpart, ring->buffer, readto);
-        }
+        const ipc_ring_msg_t padding = { IPC_RING_MSG_PADDING, tillend - (uint32_t)sizeof(ipc_ring_msg_t) };
+        memcpy(ring->buffer + wrtn, &padding, sizeof(ipc_ring_msg_t));
+        wrtn = 0;
     }
-    else
-    {
-        memcpy(dstbuffer, ring->buffer + tail, size);
 
-        if (readto == ring->size)
-            readto = 0;
-    }
+    uint8_t* const ptr = ring->buffer + wrtn;
+    memcpy(ptr, &msg, sizeof(ipc_ring_msg_t));
+
+    if (header_size != 0)
+        memcpy(ptr + sizeof(ipc_ring_msg_t), header, header_size);
+
+    if (payload_size != 0)
+        memcpy(ptr + sizeof(ipc_ring_msg_t) + header_size, payload, payload_size);
 
-    ring->tail = readto;
-    ring->flags &= ~ipc_ring_flag_error_reading;
+    wrtn += size;
+
+    if (wrtn == ring->size)
+        wrtn = 0;
+
+    ring->wrtn = wrtn;
+    ring->wflags &= ~ipc_ring_flag_error_writing;
     return true;
 }
 
+// messages are written whole or not at all, so a failed write never spoils the others pending commit
 static inline
-bool ipc_ring_write(ipc_ring_t* ring, const void* src, uint32_t size)
+bool ipc_ring_commit(ipc_ring_t* ring)
 {
-    assert(src != NULL);
-    assert(size != 0);
-    assert(size < ring->size);
-
-    uint8_t* const srcbuffer = (uint8_t*)src;
+    // nothing new
+    if (ring->head == ring->wrtn)
+        return false;
 
-    const uint32_t tail = ring->tail;
-    const uint32_t wrtn = ring->wrtn;
-    const uint32_t wrap = tail > wrtn ? 0 : ring->size;
+    // publish everything written so far
+    ipc_atomic_store_release(&ring->head, ring->wrtn);
+    return true;
+}
 
-    if (size >= wrap + tail - wrtn)
+// find the next message to read, skipping over padding
+static inline
+const uint8_t* __ipc_ring_next_msg(ipc_ring_t* ring, ipc_ring_msg_t* msg)
+{
+    for (;;)
     {
-        if ((ring->flags & ipc_ring_flag_error_writing) == 0)
-        {
-            ring->flags |= ipc_ring_flag_error_writing;
-            fprintf(stderr, "[" IPC_LOG_NAME "] ipc_ring_write failed: not enough space\n");
-        }
-        ring->flags |= ipc_ring_flag_invalidate_commit;
-        return false;
-    }
+        // empty
+        if (! __ipc_ring_can_read(ring, sizeof(ipc_ring_msg_t)))
+            return NULL;
 
-    uint32_t writeto = wrtn + size;
+        const uint8_t* const ptr = ring->buffer + ring->rdtn;
+        memcpy(msg, ptr, sizeof(ipc_ring_msg_t));
 
-    if (writeto > ring->size)
-    {
-        writeto -= ring->size;
+        if (msg->type == IPC_RING_MSG_PADDING)
+        {
+            ring->rdtn = 0;
+            continue;
+        }
 
-        if (size == 1)
+        if (msg->size < ring->size && __ipc_ring_can_read(ring, __ipc_ring_msg_size(msg->size)))
         {
-            memcpy(ring->buffer, srcbuffer, 1);
+            ring->rflags &= ~ipc_ring_flag_error_reading;
+            return ptr + sizeof(ipc_ring_msg_t);
         }
-        else
+
+        if ((ring->rflags & ipc_ring_flag_error_reading) == 0)
         {
-            const uint32_t firstpart = ring->size - wrtn;
-            memcpy(ring->buffer + wrtn, srcbuffer, firstpart);
-            memcpy(ring->buffer, srcbuffer + firstpart, writeto);
+            ring->rflags |= ipc_ring_flag_error_reading;
+            fprintf(stderr, "[" IPC_LOG_NAME "] ipc_ring_peek_msg failed: incomplete message\n");
         }
+        return NULL;
     }
-    else
-    {
-        memcpy(ring->buffer + wrtn, srcbuffer, size);
+}
 
-        if (writeto == ring->size)
-            writeto = 0;
-    }
+static inline
+void __ipc_ring_skip_msg(ipc_ring_t* ring, const ipc_ring_msg_t* msg)
+{
+    ring->rdtn += __ipc_ring_msg_size(msg->size);
 
-    ring->wrtn = writeto;
-    ring->flags &= ~ipc_ring_flag_error_writing;
-    return true;
+    if (ring->rdtn == ring->size)
+        ring->rdtn = 0;
 }
 
 static inline
-bool ipc_ring_commit(ipc_ring_t* ring)
+bool ipc_ring_peek_msg(ipc_ring_t* ring, ipc_ring_msg_t* msg)
 {
-    if (ring->flags & ipc_ring_flag_invalidate_commit)
-    {
-        ring->wrtn = ring->head;
-        ring->flags &= ~ipc_ring_flag_invalidate_commit;
-        return false;
-    }
+    assert(msg != NULL);
 
-    assert(ring->head != ring->wrtn);
+    return __ipc_ring_next_msg(ring, msg) != NULL;
+}
 
-    ring->head = ring->wrtn;
-    return true;
+// copy the payload of a message returned by ipc_ring_peek_msg and release it
+static inline
+void ipc_ring_consume_msg(ipc_ring_t* ring, const ipc_ring_msg_t* msg, void* dst)
+{
+    assert(msg != NULL);
+
+    if (dst != NULL && msg->size != 0)
+        memcpy(dst, ring->buffer + ring->rdtn + sizeof(ipc_ring_msg_t), msg->size);
+
+    __ipc_ring_skip_msg(ring, msg);
+    ipc_atomic_store_release(&ring->tail, ring->rdtn);
+}
+
+// get the next message in place, its payload stays valid until ipc_ring_release_msgs is called
+static inline
+const uint8_t* ipc_ring_acquire_msg(ipc_ring_t* ring, ipc_ring_msg_t* msg)
+{
+    assert(msg != NULL);
+
+    const uint8_t* const data = __ipc_ring_next_msg(ring, msg);
+
+    if (data != NULL)
+        __ipc_ring_skip_msg(ring, msg);
+
+    return data;
+}
+
+// give space of all messages acquired so far back to the producer
+static inline
+void ipc_ring_release_msgs(ipc_ring_t* ring)
+{
+    ipc_atomic_store_release(&ring->tail, ring->rdtn);
 }
@@ -28,6 +28,7 @@
 #endif
 
 #if defined(__APPLE__)
+ #include <time.h>
  #ifdef __cplusplus
   extern "C" {
  #endif
@@ -38,6 +39,7 @@
  #endif
 #elif defined(__linux__)
  #include <syscall.h>
+ #include <time.h>
  #include <unistd.h>
  #include <linux/futex.h>
  #include <sys/time.h>
@@ -52,25 +54,38 @@
  #include <semaphore.h>
 #endif
 
-#if defined(__APPLE__) || defined(__linux__)
-typedef int32_t ipc_sem_t;
-#elif defined(_WIN32)
-typedef HANDLE ipc_sem_t;
-#else
-typedef sem_t ipc_sem_t;
-#endif
+typedef struct {
+   #if defined(__APPLE__) || defined(__linux__)
+    // number of pending posts and sleeping waiters, posting skips the wake syscall if nobody is waiting
+    int32_t value;
+    int32_t waiters;
+   #elif defined(_WIN32)
+    HANDLE handle;
+   #else
+    sem_t sem;
+   #endif
+    // adaptive spin before sleeping, only used by the waiting side, see __ipc_sem_spin
+    int32_t spin_limit;
+} ipc_sem_t;
+
+#define IPC_SEM_SPIN_MIN 16
+#define IPC_SEM_SPIN_MAX 16384
+#define IPC_SEM_SPIN_INIT 1024
 
 static inline
 bool ipc_sem_create(ipc_sem_t* const sem)
 {
+    sem->spin_limit = IPC_SEM_SPIN_INIT;
+
    #if defined(__APPLE__) || defined(__linux__)
-    (void)sem;
+    sem->value = 0;
+    sem->waiters = 0;
     return true;
    #elif defined(_WIN32)
     SECURITY_ATTRIBUTES sa = { .nLength = sizeof(sa), .lpSecurityDescriptor = NULL, .bInheritHandle = TRUE };
-    return (*sem = CreateSemaphoreA(&sa, 0, LONG_MAX, NULL)) != NULL;
+    return (sem->handle = CreateSemaphoreA(&sa, 0, LONG_MAX, NULL)) != NULL;
    #else
-    if (sem_init(sem, 1, 0) == 0)
+    if (sem_init(&sem->sem, 1, 0) == 0)
         return true;
     fprintf(stderr, "[" IPC_LOG_NAME "] sem_init failed: %s\n", strerror(errno));
     return false;
@@ -83,62 +98,171 @@ void ipc_sem_destroy(ipc_sem_t* const sem)
    #if defined(__APPLE__) || defined(__linux__)
     (void)sem;
    #elif defined(_WIN32)
-    CloseHandle(*sem);
+    CloseHandle(sem->handle);
    #else
-    sem_destroy(sem);
+    sem_destroy(&sem->sem);
    #endif
 }
 
 static inline
 void ipc_sem_wake(ipc_sem_t* const sem)
 {
-   #if defined(__APPLE__)
-    if (__sync_bool_compare_and_swap(sem, 0, 1))
-        __ulock_wake(0x1000003, sem, 0);
-   #elif defined(__linux__)
-    if (__sync_bool_compare_and_swap(sem, 0, 1))
-        syscall(SYS_futex, sem, FUTEX_WAKE, 1, NULL, NULL, 0);
+   #if defined(__APPLE__) || defined(__linux__)
+    // pairs with ipc_sem_wait_usecs, either we see the waiter or it sees the new value
+    __atomic_fetch_add(&sem->value, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) == 0)
+        return;
+
+    #if defined(__APPLE__)
+    __ulock_wake(0x1000003, &sem->value, 0);
+    #else
+    syscall(SYS_futex, &sem->value, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+    #endif
    #elif defined(_WIN32)
-    ReleaseSemaphore(*sem, 1, NULL);
+    ReleaseSemaphore(sem->handle, 1, NULL);
    #else
-    sem_post(sem);
+    sem_post(&sem->sem);
    #endif
 }
 
+// hint to the CPU that we are busy-waiting
+#if defined(__x86_64__) || defined(__i386__)
+ #define IPC_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+ #define IPC_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+ #define IPC_CPU_RELAX() do {} while (0)
+#endif
+
+// non-blocking version of ipc_sem_wait_usecs, a successful wait consumes all pending posts at once
 static inline
-bool ipc_sem_wait_secs(ipc_sem_t* const sem, const uint32_t secs)
+bool ipc_sem_try_wait(ipc_sem_t* const sem)
 {
-   #if defined(__APPLE__)
-    for (;;)
+   #if defined(__APPLE__) || defined(__linux__)
+    // read first, avoids taking the cache line for writing while spinning
+    return __atomic_load_n(&sem->value, __ATOMIC_RELAXED) != 0
+        && __atomic_exchange_n(&sem->value, 0, __ATOMIC_SEQ_CST) != 0;
+   #elif defined(_WIN32)
+    if (WaitForSingleObject(sem->handle, 0) != WAIT_OBJECT_0)
+        return false;
+    while (WaitForSingleObject(sem->handle, 0) == WAIT_OBJECT_0) {}
+    return true;
+   #else
+    if (sem_trywait(&sem->sem) != 0)
+        return false;
+    while (sem_trywait(&sem->sem) == 0) {}
+    return true;
+   #endif
+}
+
+// spin for a bit before going to sleep, replies to synchronous requests often arrive within microseconds.
+// the spin limit follows the observed wait times, growing when spinning pays off and shrinking when it does not.
+// it is kept per semaphore, so a busy bridge does not tune the spin of idle ones.
+static inline
+bool __ipc_sem_spin(ipc_sem_t* const sem)
+{
+    const int32_t limit = __atomic_load_n(&sem->spin_limit, __ATOMIC_RELAXED);
+    int32_t next;
+
+    for (int32_t i = 0; i < limit; ++i)
     {
-        if (__sync_bool_compare_and_swap(sem, 1, 0))
+        if (ipc_sem_try_wait(sem))
+        {
+            // aim for twice the time it took this time
+            next = limit + (i * 2 + IPC_SEM_SPIN_MIN - limit) / 8;
+            __atomic_store_n(&sem->spin_limit, next > IPC_SEM_SPIN_MAX ? IPC_SEM_SPIN_MAX : next, __ATOMIC_RELAXED);
             return true;
-        if (__ulock_wait(0x3, sem, 0, secs * 1000000) != 0)
-            if (errno != EAGAIN && errno != EINTR)
-                return false;
+        }
+
+        IPC_CPU_RELAX();
     }
-   #elif defined(__linux__)
-    const struct timespec timeout = { secs, 0 };
-    for (;;)
+
+    next = limit - limit / 8;
+    __atomic_store_n(&sem->spin_limit, next < IPC_SEM_SPIN_MIN ? IPC_SEM_SPIN_MIN : next, __ATOMIC_RELAXED);
+    return false;
+}
+
+#if defined(__APPLE__) || defined(__linux__)
+static inline
+uint64_t __ipc_sem_now_usecs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+#endif
+
+static inline
+bool ipc_sem_wait_usecs(ipc_sem_t* const sem, const uint32_t usecs)
+{
+    // a zero timeout means "wait forever" for __ulock_wait, take the non-blocking path everywhere
+    if (usecs == 0)
+        return ipc_sem_try_wait(sem);
+
+    if (__ipc_sem_spin(sem))
+        return true;
+
+   #if defined(__APPLE__) || defined(__linux__)
+    // wakeups that find nothing posted do not extend the total wait
+    const uint64_t deadline = __ipc_sem_now_usecs() + usecs;
+
+    for (uint64_t now = __ipc_sem_now_usecs(); now < deadline; now = __ipc_sem_now_usecs())
     {
-        if (__sync_bool_compare_and_swap(sem, 1, 0))
+        const uint64_t remaining = deadline - now;
+       #if defined(__linux__)
+        const struct timespec timeout = { (time_t)(remaining / 1000000), (long)(remaining % 1000000) * 1000 };
+       #endif
+
+        // register as waiter before the last check, see ipc_sem_wake
+        __atomic_fetch_add(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_exchange_n(&sem->value, 0, __ATOMIC_SEQ_CST) != 0)
+        {
+            __atomic_fetch_sub(&sem->waiters, 1, __ATOMIC_SEQ_CST);
             return true;
-        if (syscall(SYS_futex, sem, FUTEX_WAIT, 0, &timeout, NULL, 0) != 0)
-            if (errno != EAGAIN && errno != EINTR)
-                return false;
+        }
+
+       #if defined(__APPLE__)
+        const int r = __ulock_wait(0x3, &sem->value, 0, (uint32_t)remaining);
+       #else
+        const int r = syscall(SYS_futex, &sem->value, FUTEX_WAIT, 0, &timeout, NULL, 0);
+       #endif
+        const int err = r < 0 ? errno : 0;
+
+        __atomic_fetch_sub(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+
+        // woken up or value changed, check again
+        if (r >= 0 || err == EAGAIN || err == EINTR)
+            continue;
+
+        break;
     }
+
+    // timed out, last chance
+    return ipc_sem_try_wait(sem);
    #elif defined(_WIN32)
-    return WaitForSingleObject(*sem, secs * 1000) == WAIT_OBJECT_0;
+    if (WaitForSingleObject(sem->handle, (usecs + 999) / 1000) != WAIT_OBJECT_0)
+        return false;
+    while (WaitForSingleObject(sem->handle, 0) == WAIT_OBJECT_0) {}
+    return true;
    #else
     struct timespec timeout;
     if (clock_gettime(CLOCK_REALTIME, &timeout) != 0)
         return false;
 
-    timeout.tv_sec += secs;
+    timeout.tv_sec += usecs / 1000000;
+    timeout.tv_nsec += (usecs % 1000000) * 1000;
+
+    if (timeout.tv_nsec >= 1000000000)
+    {
+        timeout.tv_sec += 1;
+        timeout.tv_nsec -= 1000000000;
+    }
 
     for (int r;;)
     {
-        r = sem_timedwait(sem, &timeout);
+        r = sem_timedwait(&sem->sem, &timeout);
 
         if (r < 0)
             r = errno;
@@ -146,7 +270,17 @@ bool ipc_sem_wait_secs(ipc_sem_t* const sem, const uint32_t secs)
         if (r == EINTR)
             continue;
 
-        return r == 0;
+        if (r != 0)
+            return false;
+
+        while (sem_trywait(&sem->sem) == 0) {}
+        return true;
     }
    #endif
 }
+
+static inline
+bool ipc_sem_wait_secs(ipc_sem_t* const sem, const uint32_t secs)
+{
+    return ipc_sem_wait_usecs(sem, secs < UINT32_MAX / 1000000 ? secs * 1000000 : UINT32_MAX);
+}
@@ -12,6 +12,7 @@
  #include <cstddef>
  #include <cstdint>
  #include <cstdio>
+ #include <cstring>
 #else
  #define IPC_STRUCT_INIT { 0 }
  #define _GNU_SOURCE
@@ -19,6 +20,7 @@
  #include <stddef.h>
  #include <stdint.h>
  #include <stdio.h>
+ #include <string.h>
 #endif
 
 #ifdef _WIN32
@@ -26,17 +28,26 @@
 #else
  #ifdef __cplusplus
   #include <cerrno>
-  #include <cstring>
  #else
   #include <errno.h>
-  #include <string.h>
  #endif
  #include <fcntl.h>
  #include <unistd.h>
  #include <sys/mman.h>
+ #include <sys/stat.h>
 #endif
 
-#define IPC_SHM_NAME_SIZE 32
+// room for the system prefix, a base name and the suffix of derived regions
+#define IPC_SHM_NAME_SIZE 48
+
+#ifdef _WIN32
+ #define IPC_SHM_NAME_PREFIX "Local\\"
+#else
+ #define IPC_SHM_NAME_PREFIX "/"
+#endif
+
+// longest base name that still fits together with the system prefix and a derived "-<tag><generation>" suffix
+#define IPC_SHM_BASE_NAME_MAX (IPC_SHM_NAME_SIZE - 1 - (sizeof(IPC_SHM_NAME_PREFIX) - 1) - 12)
 
 typedef struct {
     uint8_t* ptr;
@@ -60,21 +71,43 @@ typedef struct {
 } ipc_shm_client_t;
 
 static inline
-void __ipc_shm_name(char shmname[IPC_SHM_NAME_SIZE], const char* const name)
+bool __ipc_shm_name(char shmname[IPC_SHM_NAME_SIZE], const char* const name)
 {
-   #ifdef _WIN32
-    snprintf(shmname, IPC_SHM_NAME_SIZE - 1, "Local\\%s", name);
-   #else
-    snprintf(shmname, IPC_SHM_NAME_SIZE - 1, "/%s", name);
-   #endif
-    shmname[IPC_SHM_NAME_SIZE - 1] = '\0';
+    const int ret = snprintf(shmname, IPC_SHM_NAME_SIZE, IPC_SHM_NAME_PREFIX "%s", name);
+
+    if (ret < 0 || ret >= IPC_SHM_NAME_SIZE)
+    {
+        fprintf(stderr, "[" IPC_LOG_NAME "] shm name too long: %s\n", name);
+        return false;
+    }
+
+    return true;
+}
+
+// name of an extra region that belongs to `name`, as "<name>-<tag><generation>".
+// server and client must agree on it, so this fails instead of truncating.
+static inline
+bool ipc_shm_name_derive(char shmname[IPC_SHM_NAME_SIZE], const char* const name, const char tag, const uint32_t generation)
+{
+    if (strlen(name) > IPC_SHM_BASE_NAME_MAX)
+    {
+        fprintf(stderr, "[" IPC_LOG_NAME "] shm base name too long: %s\n", name);
+        return false;
+    }
+
+    // leave room for the prefix added by __ipc_shm_name
+    const int size = IPC_SHM_NAME_SIZE - (int)(sizeof(IPC_SHM_NAME_PREFIX) - 1);
+    const int ret = snprintf(shmname, size, "%s-%c%u", name, tag, generation);
+
+    return ret > 0 && ret < size;
 }
 
 static inline
 bool ipc_shm_server_check(const char* const name)
 {
     char shmname[IPC_SHM_NAME_SIZE];
-    __ipc_shm_name(shmname, name);
+    if (! __ipc_shm_name(shmname, name))
+        return false;
 
    #ifdef _WIN32
     const HANDLE handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, shmname);
@@ -98,7 +131,8 @@ static inline
 bool ipc_shm_server_create(ipc_shm_server_t* const shm, const char* const name, const uint32_t size, const bool memlock)
 {
     char shmname[IPC_SHM_NAME_SIZE] = IPC_STRUCT_INIT;
-    __ipc_shm_name(shmname, name);
+    if (! __ipc_shm_name(shmname, name))
+        return false;
 
    #ifdef _WIN32
     SECURITY_ATTRIBUTES sa = { .nLength = sizeof(sa), .lpSecurityDescriptor = NULL, .bInheritHandle = TRUE };
@@ -186,7 +220,8 @@ static inline
 bool ipc_shm_client_attach(ipc_shm_client_t* const shm, const char* const name, const uint32_t size, const bool memlock)
 {
     char shmname[IPC_SHM_NAME_SIZE] = IPC_STRUCT_INIT;
-    __ipc_shm_name(shmname, name);
+    if (! __ipc_shm_name(shmname, name))
+        return false;
 
    #ifdef _WIN32
     shm->handle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, shmname);
@@ -257,3 +292,48 @@ void ipc_shm_client_dettach(ipc_shm_client_t* const shm)
     close(shm->fd);
    #endif
 }
+
+// remove the name of an attached segment, the memory stays valid until everyone detaches
+static inline
+void ipc_shm_client_unlink(const char* const name)
+{
+   #ifdef _WIN32
+    // named mappings go away together with their last handle
+    (void)name;
+   #else
+    char shmname[IPC_SHM_NAME_SIZE] = IPC_STRUCT_INIT;
+    if (__ipc_shm_name(shmname, name))
+        shm_unlink(shmname);
+   #endif
+}
+
+// map an extra region that belongs to `name` (see ipc_shm_name_derive), then remove its name right away.
+// nobody else needs the name, this way it does not outlive both processes.
+// the other side decides the size, so this also makes sure reads stay within the region.
+static inline
+bool ipc_shm_client_attach_private(ipc_shm_client_t* const shm,
+                                   const char* const name, const char tag, const uint32_t generation,
+                                   const uint32_t size)
+{
+    char shmname[IPC_SHM_NAME_SIZE];
+
+    if (! ipc_shm_name_derive(shmname, name, tag, generation) || ! ipc_shm_client_attach(shm, shmname, size, false))
+    {
+        shm->ptr = NULL;
+        return false;
+    }
+
+   #ifndef _WIN32
+    struct stat st;
+    if (fstat(shm->fd, &st) != 0 || st.st_size < (off_t)size)
+    {
+        fprintf(stderr, "[" IPC_LOG_NAME "] ipc_shm_client_attach_private failed: region too small\n");
+        ipc_shm_client_dettach(shm);
+        shm->ptr = NULL;
+        return false;
+    }
+   #endif
+
+    ipc_shm_client_unlink(shmname);
+    return true;
+}
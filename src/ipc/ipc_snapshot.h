@@ -0,0 +1,210 @@
+// Copyright 2024 Filipe Coelho <falktx@falktx.com>
+// SPDX-License-Identifier: ISC
+
+#pragma once
+
+#ifndef IPC_LOG_NAME
+ #define IPC_LOG_NAME "ipc"
+#endif
+
+#include "ipc_ring.h"
+#include "ipc_shm.h"
+
+// shared memory region holding the latest version of some data, for things read far more often than they would
+// comfortably go through the ring, like analyzer graphs.
+// the region has two buffers, the producer writes into one while the consumer reads the last complete one.
+// each buffer has a sequence number which is odd while being written, readers retry if it changed under them.
+// like the overflow side channel, the region is replaced by a bigger one when needed, each with a new generation name.
+
+#define IPC_SNAPSHOT_MIN_SIZE 0x10000
+#define IPC_SNAPSHOT_MAX_SIZE 0x4000000
+
+// attempts at reading while the producer keeps rewriting the buffer
+#define IPC_SNAPSHOT_READ_RETRIES 4
+
+typedef struct {
+    uint32_t seq, size;
+} ipc_snapshot_buffer_t;
+
+typedef struct {
+    // index of the last complete buffer
+    uint32_t latest;
+    uint32_t capacity;
+    ipc_snapshot_buffer_t buffers[2];
+    // followed by both buffers, `capacity` bytes each
+    IPC_ALIGNAS(IPC_CACHELINE_SIZE) uint8_t data[];
+} ipc_snapshot_data_t;
+
+// producer side
+typedef struct {
+    ipc_shm_server_t shm;
+    uint32_t generation, capacity;
+    // buffer being written, between begin and publish
+    uint32_t writing;
+} ipc_snapshot_writer_t;
+
+// consumer side
+typedef struct {
+    ipc_shm_client_t shm;
+    uint32_t generation, capacity;
+} ipc_snapshot_reader_t;
+
+static inline
+uint32_t __ipc_snapshot_region_size(const uint32_t capacity)
+{
+    return sizeof(ipc_snapshot_data_t) + capacity * 2;
+}
+
+static inline
+void ipc_snapshot_writer_destroy(ipc_snapshot_writer_t* const writer)
+{
+    if (writer->shm.ptr != NULL)
+        ipc_shm_server_destroy(&writer->shm);
+
+    writer->shm.ptr = NULL;
+    writer->capacity = 0;
+}
+
+static inline
+void ipc_snapshot_reader_destroy(ipc_snapshot_reader_t* const reader)
+{
+    if (reader->shm.ptr != NULL)
+        ipc_shm_client_dettach(&reader->shm);
+
+    reader->shm.ptr = NULL;
+    reader->capacity = 0;
+}
+
+// replace the region with one that fits at least `size` bytes per buffer.
+// the consumer must be told the new generation and capacity, after which it attaches on its own.
+static inline
+bool ipc_snapshot_writer_create(ipc_snapshot_writer_t* const writer, const char* const name, const uint32_t size)
+{
+    if (size > IPC_SNAPSHOT_MAX_SIZE)
+        return false;
+
+    uint32_t capacity = IPC_SNAPSHOT_MIN_SIZE;
+    while (capacity < size)
+        capacity *= 2;
+
+    // the consumer keeps its own mapping of the old region until it switches over
+    ipc_snapshot_writer_destroy(writer);
+
+    char shmname[IPC_SHM_NAME_SIZE];
+
+    if (! ipc_shm_name_derive(shmname, name, 'd', ++writer->generation) ||
+        ! ipc_shm_server_create(&writer->shm, shmname, __ipc_snapshot_region_size(capacity), false))
+    {
+        writer->shm.ptr = NULL;
+        return false;
+    }
+
+    ipc_snapshot_data_t* const snapshot = (ipc_snapshot_data_t*)writer->shm.ptr;
+    memset(snapshot, 0, sizeof(ipc_snapshot_data_t));
+    snapshot->capacity = capacity;
+
+    writer->capacity = capacity;
+    return true;
+}
+
+// get the buffer to write the next snapshot into, `capacity` bytes big.
+// must be followed by ipc_snapshot_writer_publish or ipc_snapshot_writer_cancel.
+static inline
+uint8_t* ipc_snapshot_writer_begin(ipc_snapshot_writer_t* const writer)
+{
+    ipc_snapshot_data_t* const snapshot = (ipc_snapshot_data_t*)writer->shm.ptr;
+
+    if (snapshot == NULL)
+        return NULL;
+
+    const uint32_t index = snapshot->latest ^ 1;
+    ipc_snapshot_buffer_t* const buffer = &snapshot->buffers[index];
+
+    // odd sequence lets readers of this buffer know it is being rewritten, before any data changes
+    __atomic_store_n(&buffer->seq, buffer->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    writer->writing = index;
+    return snapshot->data + (size_t)writer->capacity * index;
+}
+
+// make the buffer given by ipc_snapshot_writer_begin the latest one
+static inline
+void ipc_snapshot_writer_publish(ipc_snapshot_writer_t* const writer, const uint32_t size)
+{
+    ipc_snapshot_data_t* const snapshot = (ipc_snapshot_data_t*)writer->shm.ptr;
+    ipc_snapshot_buffer_t* const buffer = &snapshot->buffers[writer->writing];
+
+    __atomic_store_n(&buffer->size, size, __ATOMIC_RELAXED);
+    __atomic_store_n(&buffer->seq, buffer->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&snapshot->latest, writer->writing, __ATOMIC_RELEASE);
+}
+
+// nothing new to publish, the latest buffer stays as-is
+static inline
+void ipc_snapshot_writer_cancel(ipc_snapshot_writer_t* const writer)
+{
+    ipc_snapshot_data_t* const snapshot = (ipc_snapshot_data_t*)writer->shm.ptr;
+    ipc_snapshot_buffer_t* const buffer = &snapshot->buffers[writer->writing];
+
+    __atomic_store_n(&buffer->seq, buffer->seq + 1, __ATOMIC_RELEASE);
+}
+
+// map the region of the given generation, unless already mapped
+static inline
+bool ipc_snapshot_reader_attach(ipc_snapshot_reader_t* const reader,
+                                const char* const name,
+                                const uint32_t generation, const uint32_t capacity)
+{
+    if (reader->shm.ptr != NULL && reader->generation == generation && reader->capacity == capacity)
+        return true;
+
+    if (capacity > IPC_SNAPSHOT_MAX_SIZE)
+        return false;
+
+    ipc_snapshot_reader_destroy(reader);
+
+    if (! ipc_shm_client_attach_private(&reader->shm, name, 'd', generation, __ipc_snapshot_region_size(capacity)))
+        return false;
+
+    reader->generation = generation;
+    reader->capacity = capacity;
+    return true;
+}
+
+// copy the latest snapshot into `dst`, returns its size.
+// if bigger than `size` nothing is copied, callers can retry with a bigger buffer.
+// returns 0 if nothing was published yet, or if the producer kept rewriting it while reading.
+static inline
+uint32_t ipc_snapshot_read(const ipc_snapshot_reader_t* const reader, void* const dst, const uint32_t size)
+{
+    const ipc_snapshot_data_t* const snapshot = (const ipc_snapshot_data_t*)reader->shm.ptr;
+
+    if (snapshot == NULL)
+        return 0;
+
+    for (uint32_t i = 0; i < IPC_SNAPSHOT_READ_RETRIES; ++i)
+    {
+        const uint32_t index = __atomic_load_n(&snapshot->latest, __ATOMIC_ACQUIRE) & 1;
+        const ipc_snapshot_buffer_t* const buffer = &snapshot->buffers[index];
+
+        const uint32_t seq = __atomic_load_n(&buffer->seq, __ATOMIC_ACQUIRE);
+        if (seq == 0 || (seq & 1) != 0)
+            continue;
+
+        const uint32_t data_size = __atomic_load_n(&buffer->size, __ATOMIC_RELAXED);
+        if (data_size > reader->capacity)
+            continue;
+
+        if (data_size <= size && data_size != 0)
+            memcpy(dst, snapshot->data + (size_t)reader->capacity * index, data_size);
+
+        // data reads must be done before checking the sequence again
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&buffer->seq, __ATOMIC_RELAXED) == seq)
+            return data_size;
+    }
+
+    return 0;
+}
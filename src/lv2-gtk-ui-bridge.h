@@ -0,0 +1,48 @@
+// Copyright 2024 Filipe Coelho <falktx@falktx.com>
+// SPDX-License-Identifier: ISC
+
+// Optional extensions provided by lv2-gtk-ui-bridge UIs, hosts can copy this file as needed
+
+#pragma once
+
+#include <lv2/ui/ui.h>
+
+#define LV2_GTK_UI_BRIDGE_URI "https://kx.studio/lv2-gtk-ui-bridge"
+#define LV2_GTK_UI_BRIDGE_PREFIX LV2_GTK_UI_BRIDGE_URI "#"
+
+#define LV2_GTK_UI_BRIDGE__notifyInterface LV2_GTK_UI_BRIDGE_PREFIX "notifyInterface"
+
+/**
+ * UI extension data, lets hosts with an event loop react to UI changes right away instead of waiting for the next idle.
+ */
+typedef struct {
+    /**
+     * Get a file descriptor that becomes readable when the bridged UI has new data for the host.
+     * The host should call LV2UI_Idle_Interface::idle when that happens, which also resets it.
+     * Returns -1 if not available, in which case the host should keep calling idle periodically as usual.
+     * The file descriptor is owned by the UI and valid until cleanup.
+     */
+    int (*get_fd)(LV2UI_Handle ui);
+} LV2_GTK_UI_Bridge_Notify_Interface;
+
+#define LV2_GTK_UI_BRIDGE__displayData LV2_GTK_UI_BRIDGE_PREFIX "displayData"
+
+typedef void* LV2_GTK_UI_Bridge_Display_Data_Handle;
+
+/**
+ * Feature for plugin data drawn by UIs at a high rate, like analyzer graphs, as a replacement for instance access.
+ * Hosts provide it to lv2-gtk-ui-bridge, which keeps a copy of the latest data in shared memory.
+ * lv2-gtk-ui-bridge provides the same feature to the bridged UI, reading from that copy.
+ * The data format is private to the plugin and its UI.
+ */
+typedef struct {
+    LV2_GTK_UI_Bridge_Display_Data_Handle handle;
+
+    /**
+     * Copy the latest display data into `buffer`, returns its size.
+     * If the data is bigger than `size` nothing is copied, callers can retry with a bigger buffer.
+     * Returns 0 if there is no data available.
+     * Called from the UI thread, the host side is called on idle once the bridged UI starts reading the data.
+     */
+    uint32_t (*read)(LV2_GTK_UI_Bridge_Display_Data_Handle handle, void* buffer, uint32_t size);
+} LV2_GTK_UI_Bridge_Display_Data;
@@ -0,0 +1,214 @@
+// Copyright 2024 Filipe Coelho <falktx@falktx.com>
+// SPDX-License-Identifier: ISC
+
+// Prints statistics of running bridges, read directly from their shared memory segments
+
+#include "ipc/ipc.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LV2UI_SHM_DIR "/dev/shm/"
+#define LV2UI_SHM_PREFIX "lv2-gtk-ui-bridge-"
+
+// only main segments, not side channel regions (which have a "-s1"-like suffix)
+static bool lv2ui_stat_is_bridge(const char* const name)
+{
+    if (strncmp(name, LV2UI_SHM_PREFIX, strlen(LV2UI_SHM_PREFIX)) != 0)
+        return false;
+
+    const char* c = name + strlen(LV2UI_SHM_PREFIX);
+    if (*c == '\0')
+        return false;
+
+    for (; *c != '\0'; ++c)
+    {
+        if (*c < '0' || *c > '9')
+            return false;
+    }
+
+    return true;
+}
+
+static uint32_t lv2ui_stat_ring_used(const ipc_ring_t* const ring)
+{
+    const uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    const uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    return head >= tail ? head - tail : ring->size + head - tail;
+}
+
+static void lv2ui_stat_print_direction(const char* const name,
+                                       const char* const direction,
+                                       const ipc_stats_t* const stats,
+                                       const ipc_ring_t* const ring)
+{
+    const double size = ring->size;
+
+    printf("%-24s %-8s %10llu %12llu %6.1f%% %6.1f%% %8u %8u %8u %8u %10.1f\n",
+           name,
+           direction,
+           (unsigned long long)stats->messages,
+           (unsigned long long)stats->bytes,
+           lv2ui_stat_ring_used(ring) * 100.0 / size,
+           stats->high_water * 100.0 / size,
+           stats->overflows,
+           stats->drops + stats->lost,
+           stats->commit_failures,
+           stats->roundtrips,
+           stats->wake_latency_ns / 1000.0);
+}
+
+static bool lv2ui_stat_print(const char* const name)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), LV2UI_SHM_DIR "%s", name);
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ipc_shared_data_t))
+    {
+        close(fd);
+        return false;
+    }
+
+    const size_t size = (size_t)st.st_size;
+
+    // read-only, never interferes with the bridge
+    void* const ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (ptr == MAP_FAILED)
+        return false;
+
+    const ipc_shared_data_t* const shared_data = (const ipc_shared_data_t*)ptr;
+    const uint32_t rbsize = shared_data->rbsize;
+    const bool valid = rbsize != 0 && sizeof(ipc_shared_data_t) + (size_t)ipc_ring_alloc_size(rbsize) * 2 <= size;
+
+    if (valid)
+    {
+        const ipc_ring_t* const ring_server = (const ipc_ring_t*)shared_data->rbdata;
+        const ipc_ring_t* const ring_client = (const ipc_ring_t*)(shared_data->rbdata + ipc_ring_alloc_size(rbsize));
+
+        ipc_stats_t stats_server, stats_client;
+        __ipc_stats_load(&stats_server, &shared_data->stats_server);
+        __ipc_stats_load(&stats_client, &shared_data->stats_client);
+
+        lv2ui_stat_print_direction(name, "host>ui", &stats_server, ring_server);
+        lv2ui_stat_print_direction(name, "ui>host", &stats_client, ring_client);
+    }
+
+    munmap(ptr, size);
+    return valid;
+}
+
+static int lv2ui_stat_compare(const void* const a, const void* const b)
+{
+    const char* const name_a = *(const char* const*)a;
+    const char* const name_b = *(const char* const*)b;
+    const size_t len_a = strlen(name_a);
+    const size_t len_b = strlen(name_b);
+
+    // numeric order for same prefix
+    return len_a != len_b ? (len_a < len_b ? -1 : 1) : strcmp(name_a, name_b);
+}
+
+// print all bridges, or only those given by name
+static uint32_t lv2ui_stat_print_all(char* const names[], const int num_names)
+{
+    printf("%-24s %-8s %10s %12s %7s %7s %8s %8s %8s %8s %10s\n",
+           "NAME", "DIR", "MESSAGES", "BYTES", "FILL", "HIGH", "OVERFLOW", "DROPS", "CFAIL", "RTRIPS", "WAKE(us)");
+
+    if (num_names != 0)
+    {
+        uint32_t count = 0;
+        for (int i = 0; i < num_names; ++i)
+        {
+            if (lv2ui_stat_print(names[i]))
+                ++count;
+            else
+                fprintf(stderr, "%s: not a running bridge\n", names[i]);
+        }
+        return count;
+    }
+
+    DIR* const dir = opendir(LV2UI_SHM_DIR);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "could not open " LV2UI_SHM_DIR ": %s\n", strerror(errno));
+        return 0;
+    }
+
+    char** found = NULL;
+    uint32_t num_found = 0;
+
+    for (struct dirent* entry; (entry = readdir(dir)) != NULL;)
+    {
+        if (! lv2ui_stat_is_bridge(entry->d_name))
+            continue;
+
+        char** const new_found = realloc(found, sizeof(char*) * (num_found + 1));
+        if (new_found == NULL)
+            break;
+
+        found = new_found;
+        found[num_found++] = strdup(entry->d_name);
+    }
+
+    closedir(dir);
+
+    qsort(found, num_found, sizeof(char*), lv2ui_stat_compare);
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < num_found; ++i)
+    {
+        if (found[i] != NULL && lv2ui_stat_print(found[i]))
+            ++count;
+
+        free(found[i]);
+    }
+
+    free(found);
+    return count;
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t watch_secs = 0;
+    int first_name = 1;
+
+    if (argc > 1 && (strcmp(argv[1], "-w") == 0 || strcmp(argv[1], "--watch") == 0))
+    {
+        watch_secs = 1;
+        first_name = 2;
+
+        if (argc > 2 && atoi(argv[2]) > 0)
+        {
+            watch_secs = (uint32_t)atoi(argv[2]);
+            first_name = 3;
+        }
+    }
+    else if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0))
+    {
+        fprintf(stderr, "usage: %s [-w|--watch [seconds]] [shm-name...]\n", argv[0]);
+        return 0;
+    }
+
+    if (watch_secs == 0)
+        return lv2ui_stat_print_all(argv + first_name, argc - first_name) != 0 ? 0 : 1;
+
+    for (;;)
+    {
+        lv2ui_stat_print_all(argv + first_name, argc - first_name);
+        printf("\n");
+        fflush(stdout);
+        sleep(watch_secs);
+    }
+
+    return 0;
+}
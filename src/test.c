@@ -12,17 +12,364 @@ void sleep(const unsigned int secs)
 {
     Sleep(secs * 1000);
 }
+#else
+#include <poll.h>
 #endif
 
+static void test_ring_msg(void)
+{
+    IPC_ALIGNAS(IPC_CACHELINE_SIZE) static uint8_t storage[sizeof(ipc_ring_t) + 64];
+    ipc_ring_t* const ring = (ipc_ring_t*)storage;
+    ipc_ring_init(ring, 64);
+
+    const uint32_t header = 0x1234;
+    const char payload[] = "framed";
+    char dst[16] = IPC_STRUCT_INIT;
+    ipc_ring_msg_t msg;
+
+    // go around the ring a few times so messages wrap
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        assert(ipc_ring_write_msg(ring, i + 1, &header, sizeof(header), payload, sizeof(payload)));
+        assert(ipc_ring_commit(ring));
+        assert(ipc_ring_peek_msg(ring, &msg));
+        assert(msg.type == i + 1);
+        assert(msg.size == sizeof(header) + sizeof(payload));
+        ipc_ring_consume_msg(ring, &msg, dst);
+        assert(memcmp(dst, &header, sizeof(header)) == 0);
+        assert(strcmp(dst + sizeof(header), payload) == 0);
+        assert(! ipc_ring_peek_msg(ring, &msg));
+    }
+
+    // in place reads, payload is contiguous and aligned even after wrapping
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        assert(ipc_ring_write_msg(ring, i + 1, &header, sizeof(header), payload, sizeof(payload)));
+        assert(ipc_ring_commit(ring));
+        const uint8_t* const data = ipc_ring_acquire_msg(ring, &msg);
+        assert(data != NULL);
+        assert(((uintptr_t)data % IPC_RING_MSG_ALIGN) == 0);
+        assert(msg.type == i + 1);
+        assert(strcmp((const char*)data + sizeof(header), payload) == 0);
+        ipc_ring_release_msgs(ring);
+    }
+
+    // too big, must not affect other messages pending commit
+    static const uint8_t big[64] = IPC_STRUCT_INIT;
+    assert(ipc_ring_write_msg(ring, 1, NULL, 0, payload, sizeof(payload)));
+    assert(! ipc_ring_write_msg(ring, 2, NULL, 0, big, sizeof(big)));
+    assert(ipc_ring_commit(ring));
+    assert(! ipc_ring_commit(ring));
+    assert(ipc_ring_peek_msg(ring, &msg));
+    assert(msg.type == 1);
+    ipc_ring_consume_msg(ring, &msg, NULL);
+    assert(! ipc_ring_peek_msg(ring, &msg));
+}
+
+static void test_sem(void)
+{
+    // futex-based semaphores live in zero-initialized shared memory
+    ipc_sem_t sem = IPC_STRUCT_INIT;
+    assert(ipc_sem_create(&sem));
+
+    // nothing posted, times out after spinning
+    assert(!ipc_sem_try_wait(&sem));
+    assert(!ipc_sem_wait_usecs(&sem, 1000));
+
+    // a zero timeout does not block, but still takes what was posted
+    assert(!ipc_sem_wait_usecs(&sem, 0));
+    ipc_sem_wake(&sem);
+    assert(ipc_sem_wait_usecs(&sem, 0));
+
+    ipc_sem_wake(&sem);
+    assert(ipc_sem_wait_usecs(&sem, 1000));
+    assert(!ipc_sem_try_wait(&sem));
+
+    // several posts are consumed by a single wait
+    ipc_sem_wake(&sem);
+    ipc_sem_wake(&sem);
+    ipc_sem_wake(&sem);
+    assert(ipc_sem_wait_usecs(&sem, 1000));
+    assert(!ipc_sem_try_wait(&sem));
+
+    ipc_sem_destroy(&sem);
+}
+
+static void test_fragments(void)
+{
+    ipc_server_t* const server = ipc_server_create("test3", 256);
+    assert(server);
+    ipc_client_t* const client = ipc_client_attach("test3");
+    assert(client);
+
+    uint8_t big[3000];
+    for (uint32_t i = 0; i < sizeof(big); ++i)
+        big[i] = (uint8_t)(i * 7);
+
+    // first large message takes the side channel, the next one is sent in fragments
+    assert(ipc_server_write_msg(server, 1, NULL, 0, big, sizeof(big)));
+    assert(ipc_server_write_msg(server, 2, NULL, 0, big, sizeof(big)));
+    assert(ipc_server_backlog_size(server) != 0);
+    // nothing goes in between
+    assert(!ipc_server_write_msg(server, 3, NULL, 0, NULL, 0));
+    assert(ipc_server_commit(server));
+
+    ipc_ring_msg_t msg;
+    uint32_t received = 0;
+    for (int i = 0; i < 1000 && received < 2; ++i)
+    {
+        for (const uint8_t* data; (data = ipc_client_acquire_msg(client, &msg)) != NULL; ++received)
+        {
+            assert(msg.type == received + 1 && msg.size == sizeof(big));
+            assert(memcmp(data, big, sizeof(big)) == 0);
+        }
+        ipc_client_release_msgs(client);
+        ipc_server_commit(server);
+    }
+    assert(received == 2);
+    assert(ipc_server_backlog_size(server) == 0);
+
+    // same the other way around, copying messages out
+    uint8_t dst[sizeof(big)];
+    assert(ipc_client_write_msg(client, 1, NULL, 0, big, sizeof(big)));
+    assert(ipc_client_write_msg(client, 2, NULL, 0, big, sizeof(big)));
+    assert(ipc_client_commit(client));
+
+    received = 0;
+    for (int i = 0; i < 1000 && received < 2; ++i)
+    {
+        for (; ipc_server_peek_msg(server, &msg); ++received)
+        {
+            assert(msg.type == received + 1 && msg.size == sizeof(big));
+            memset(dst, 0, sizeof(dst));
+            ipc_server_consume_msg(server, &msg, dst);
+            assert(memcmp(dst, big, sizeof(big)) == 0);
+        }
+        ipc_client_commit(client);
+    }
+    assert(received == 2);
+    assert(ipc_client_backlog_size(client) == 0);
+
+   #ifndef _WIN32
+    // side channel region gone before the reader maps it, the reference is dropped and the channel reused.
+    // needs a new region, so more than what the previous messages needed
+    static uint8_t huge[IPC_OVERFLOW_MIN_SIZE + 1];
+    char shmname[IPC_SHM_NAME_SIZE];
+    assert(ipc_server_write_msg(server, 5, NULL, 0, huge, sizeof(huge)));
+    assert(ipc_shm_name_derive(shmname, server->name, 's', server->overflow_send.generation));
+    ipc_shm_client_unlink(shmname);
+    assert(ipc_server_commit(server));
+    assert(!ipc_client_peek_msg(client, &msg));
+
+    ipc_stats_t send, recv;
+    ipc_server_get_stats(server, &send, &recv);
+    assert(send.lost == 1);
+
+    assert(ipc_server_write_msg(server, 6, NULL, 0, big, sizeof(big)));
+    assert(ipc_server_commit(server));
+    assert(ipc_client_peek_msg(client, &msg));
+    assert(msg.type == 6 && msg.size == sizeof(big));
+    ipc_client_consume_msg(client, &msg, NULL);
+   #endif
+
+    ipc_client_dettach(client);
+    ipc_server_stop(server);
+}
+
+static void test_write_policies(void)
+{
+    ipc_server_t* const server = ipc_server_create("test4", 64);
+    assert(server);
+    ipc_client_t* const client = ipc_client_attach("test4");
+    assert(client);
+
+    ipc_server_set_write_policy(server, 5, ipc_write_policy_drop_oldest, 0);
+    ipc_server_set_write_policy(server, 6, ipc_write_policy_never_drop, 0);
+
+    // fill the ring
+    const uint32_t key = 1;
+    uint32_t value = 0;
+    while (ipc_server_write_msg(server, 1, NULL, 0, &value, sizeof(value)))
+        ++value;
+    const uint32_t filled = value;
+
+    ipc_stats_t send, recv;
+    ipc_server_get_stats(server, &send, &recv);
+    assert(send.overflows == 1 && send.drops == 1);
+
+    // newer value replaces the older one while waiting for room
+    value = 10;
+    assert(ipc_server_write_msg(server, 5, &key, sizeof(key), &value, sizeof(value)));
+    value = 11;
+    assert(ipc_server_write_msg(server, 5, &key, sizeof(key), &value, sizeof(value)));
+    // queued until there is room
+    assert(ipc_server_write_msg(server, 6, NULL, 0, &value, sizeof(value)));
+    assert(ipc_server_backlog_size(server) != 0);
+
+    ipc_server_get_stats(server, &send, &recv);
+    assert(send.overflows == 4 && send.drops == 2);
+    ipc_client_get_stats(client, &send, &recv);
+    assert(recv.overflows == 4 && recv.drops == 2);
+
+    assert(ipc_server_commit(server));
+
+    ipc_ring_msg_t msg;
+    bool got_latest = false, got_queued = false;
+    for (int i = 0; i < 10 && ! got_queued; ++i)
+    {
+        for (const uint8_t* data; (data = ipc_client_acquire_msg(client, &msg)) != NULL;)
+        {
+            if (msg.type == 5)
+            {
+                assert(msg.size == sizeof(uint32_t) * 2);
+                memcpy(&value, data + sizeof(uint32_t), sizeof(value));
+                assert(value == 11);
+                got_latest = true;
+            }
+            else if (msg.type == 6)
+            {
+                got_queued = true;
+            }
+        }
+        ipc_client_release_msgs(client);
+        ipc_server_commit(server);
+    }
+    assert(got_latest && got_queued);
+    assert(ipc_server_backlog_size(server) == 0);
+
+    ipc_server_get_stats(server, &send, &recv);
+    assert(send.messages == filled + 3);
+    assert(send.bytes == (filled + 1) * sizeof(uint32_t) + 2 * sizeof(uint32_t) * 2);
+    assert(send.high_water != 0 && send.high_water < 64);
+    assert(send.last_commit_ns != 0);
+
+    // waking up for the commits records the latency once, rearming without a new commit does not
+    assert(ipc_client_wait_usecs(client, 1000));
+    ipc_server_get_stats(server, &send, &recv);
+    assert(send.last_commit_ns == 0);
+    const uint64_t wake_latency_ns = send.wake_latency_ns;
+    ipc_client_notify_rearm(client);
+    ipc_server_get_stats(server, &send, &recv);
+    assert(send.wake_latency_ns == wake_latency_ns);
+
+    ipc_client_dettach(client);
+    ipc_server_stop(server);
+}
+
+static void test_snapshot(void)
+{
+    ipc_snapshot_writer_t writer = IPC_STRUCT_INIT;
+    ipc_snapshot_reader_t reader = IPC_STRUCT_INIT;
+    uint32_t src[4] = { 1, 2, 3, 4 };
+    uint32_t dst[4] = IPC_STRUCT_INIT;
+
+    assert(ipc_snapshot_writer_create(&writer, "test5", sizeof(src)));
+    assert(writer.capacity >= sizeof(src));
+    assert(ipc_snapshot_reader_attach(&reader, "test5", writer.generation, writer.capacity));
+
+    // nothing published yet
+    assert(ipc_snapshot_read(&reader, dst, sizeof(dst)) == 0);
+
+    uint8_t* buffer = ipc_snapshot_writer_begin(&writer);
+    assert(buffer != NULL);
+    memcpy(buffer, src, sizeof(src));
+    ipc_snapshot_writer_publish(&writer, sizeof(src));
+
+    assert(ipc_snapshot_read(&reader, dst, sizeof(dst)) == sizeof(src));
+    assert(memcmp(dst, src, sizeof(src)) == 0);
+
+    // a buffer being written or given up on does not affect the latest one
+    src[0] = 5;
+    buffer = ipc_snapshot_writer_begin(&writer);
+    memcpy(buffer, src, sizeof(src));
+    memset(dst, 0, sizeof(dst));
+    assert(ipc_snapshot_read(&reader, dst, sizeof(dst)) == sizeof(src));
+    assert(dst[0] == 1);
+    ipc_snapshot_writer_cancel(&writer);
+    assert(ipc_snapshot_read(&reader, dst, sizeof(dst)) == sizeof(src));
+    assert(dst[0] == 1);
+
+    buffer = ipc_snapshot_writer_begin(&writer);
+    memcpy(buffer, src, sizeof(src));
+    ipc_snapshot_writer_publish(&writer, sizeof(src));
+    assert(ipc_snapshot_read(&reader, dst, sizeof(dst)) == sizeof(src));
+    assert(dst[0] == 5);
+
+    // too small, nothing copied
+    memset(dst, 0, sizeof(dst));
+    assert(ipc_snapshot_read(&reader, dst, sizeof(uint32_t)) == sizeof(src));
+    assert(dst[0] == 0);
+
+    ipc_snapshot_reader_destroy(&reader);
+    ipc_snapshot_writer_destroy(&writer);
+}
+
+static void test_respawn(void)
+{
+   #ifndef _WIN32
+    // client process exits right away, like a crashing one would
+    const char* args[] = { "/bin/true", NULL };
+    ipc_server_t* server = ipc_server_launch(args, "test6", 64);
+    assert(server);
+    const int32_t fd = ipc_server_notify_fd(server);
+    assert(fd >= 0);
+
+    for (int i = 0; i < 100 && ipc_server_is_running(server); ++i)
+        usleep(10000);
+    assert(!ipc_server_is_running(server));
+
+    server = ipc_server_respawn(server, args, "test7");
+    assert(server);
+    assert(strcmp(server->name, "test7") == 0);
+    // same pollable handle, event loops keep working
+    assert(ipc_server_notify_fd(server) == fd);
+    // old segment is gone
+    assert(ipc_server_check("test6"));
+    ipc_server_stop(server);
+   #endif
+}
+
 int main(int argc, char* argv[])
 {
     if (argc == 1)
     {
+        test_ring_msg();
+        test_sem();
+        test_fragments();
+        test_write_policies();
+        test_snapshot();
+        test_respawn();
+
         printf("starting server...\n");
         const char* const shm_name = "test2";
         const char* args[] = { argv[0], shm_name, NULL };
-        ipc_server_t* const server = ipc_server_start(args, shm_name, 32);
+        ipc_server_t* const server = ipc_server_start(args, shm_name, 64);
         assert(server);
+        assert(ipc_server_write_msg(server, 1, NULL, 0, NULL, 0));
+        // too big for the ring, goes through the side channel
+        uint8_t big[1000];
+        for (uint32_t i = 0; i < sizeof(big); ++i)
+            big[i] = (uint8_t)i;
+        assert(ipc_server_write_msg(server, 3, NULL, 0, big, sizeof(big)));
+        assert(ipc_server_commit(server));
+       #ifndef _WIN32
+        // and the same the other way around
+        struct pollfd pfd = { ipc_server_notify_fd(server), POLLIN, 0 };
+        assert(pfd.fd >= 0);
+        assert(poll(&pfd, 1, 2000) == 1);
+        ipc_server_notify_clear(server);
+        assert(poll(&pfd, 1, 0) == 0);
+        ipc_ring_msg_t msg;
+        assert(ipc_server_peek_msg(server, &msg));
+        assert(msg.type == 2);
+        ipc_server_consume_msg(server, &msg, NULL);
+        uint8_t dst[sizeof(big)] = IPC_STRUCT_INIT;
+        assert(ipc_server_peek_msg(server, &msg));
+        assert(msg.type == 4 && msg.size == sizeof(big));
+        ipc_server_consume_msg(server, &msg, dst);
+        assert(memcmp(dst, big, sizeof(big)) == 0);
+        assert(!ipc_server_peek_msg(server, &msg));
+       #endif
         sleep(2);
         assert(!ipc_server_is_running(server));
         ipc_server_stop(server);
@@ -31,8 +378,30 @@ int main(int argc, char* argv[])
     else
     {
         printf("starting client...\n");
-        ipc_client_t* const client = ipc_client_attach(argv[1], 32);
+        ipc_client_t* const client = ipc_client_attach(argv[1]);
         assert(client);
+       #ifndef _WIN32
+        // commit from the server side wakes up the pollable handle
+        const int32_t fd = ipc_client_notify_fd(client);
+        assert(fd >= 0);
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        assert(poll(&pfd, 1, 1000) == 1);
+        ipc_notify_clear(fd);
+        ipc_client_notify_rearm(client);
+        ipc_ring_msg_t msg;
+        assert(ipc_client_peek_msg(client, &msg));
+        assert(msg.type == 1);
+        ipc_client_consume_msg(client, &msg, NULL);
+        const uint8_t* const big = ipc_client_acquire_msg(client, &msg);
+        assert(big != NULL);
+        assert(msg.type == 3 && msg.size == 1000);
+        for (uint32_t i = 0; i < msg.size; ++i)
+            assert(big[i] == (uint8_t)i);
+        assert(ipc_client_write_msg(client, 2, NULL, 0, NULL, 0));
+        assert(ipc_client_write_msg(client, 4, NULL, 0, big, msg.size));
+        ipc_client_release_msgs(client);
+        assert(ipc_client_commit(client));
+       #endif
         sleep(1);
         ipc_client_dettach(client);
         printf("client done\n");
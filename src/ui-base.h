@@ -4,12 +4,155 @@
 #include "ipc/ipc.h"
 #include <lv2/ui/ui.h>
 
-const uint32_t rbsize = 0x7fff;
+// default ring size, can be changed with the LV2_GTK_UI_BRIDGE_RING_SIZE environment variable
+const uint32_t rbsize = 0x8000;
 
 typedef enum {
     lv2ui_message_null,
     lv2ui_message_port_event,
     lv2ui_message_urid_map_req,
     lv2ui_message_urid_map_resp,
+    // sent once the UI is ready, answered with a snapshot of all known control port values
     lv2ui_message_window_id,
+    // list of NUL-terminated URIs, answered with one lv2ui_message_urid_map_resp each in a single commit
+    lv2ui_message_urid_map_batch_req,
+    // sent to a pooled bridge process, uint64 parent window id followed by the NUL-terminated plugin URI
+    lv2ui_message_load,
+    // sent to a shared bridge process through its control channel,
+    // uint64 parent window id followed by the NUL-terminated shm name and plugin URI
+    lv2ui_message_attach,
+    // asks a UI in a shared bridge process to close, the same message is sent back once done
+    lv2ui_message_detach,
+    // sent without payload once the UI starts reading display data, see LV2_GTK_UI_BRIDGE__displayData.
+    // answered with uint32 generation and capacity of the shared memory region holding it, whenever it changes
+    lv2ui_message_display_data,
+    // values of float control ports, one or more LV2UI_Bridge_Control packed together
+    lv2ui_message_controls,
 } LV2UI_Bridge_Message_Type;
+
+// payload prefix of lv2ui_message_port_event, followed by the port data
+typedef struct {
+    uint32_t port_index;
+    uint32_t format;
+} LV2UI_Bridge_Port_Event;
+
+// payload of lv2ui_message_controls, repeated for each port
+typedef struct {
+    uint32_t port_index;
+    float value;
+} LV2UI_Bridge_Control;
+
+typedef struct {
+    float value;
+    bool dirty;
+    // value was set at least once
+    bool known;
+} LV2UI_Control_Port;
+
+// last known value of each float control port, sent to the other side in batches
+typedef struct {
+    LV2UI_Control_Port* ports;
+    uint32_t* dirty_list;
+    // scratch memory for packing dirty ports into a lv2ui_message_controls
+    LV2UI_Bridge_Control* packed;
+    uint32_t num_ports;
+    uint32_t num_dirty;
+} LV2UI_Controls;
+
+static inline
+bool lv2ui_controls_set(LV2UI_Controls* const controls, const uint32_t port_index, const float value)
+{
+    if (port_index >= controls->num_ports)
+    {
+        uint32_t num_ports = controls->num_ports != 0 ? controls->num_ports * 2 : 32;
+        while (port_index >= num_ports)
+            num_ports *= 2;
+
+        LV2UI_Control_Port* const ports = realloc(controls->ports, sizeof(LV2UI_Control_Port) * num_ports);
+        if (ports == NULL)
+            return false;
+
+        controls->ports = ports;
+
+        uint32_t* const dirty_list = realloc(controls->dirty_list, sizeof(uint32_t) * num_ports);
+        if (dirty_list == NULL)
+            return false;
+
+        controls->dirty_list = dirty_list;
+
+        LV2UI_Bridge_Control* const packed = realloc(controls->packed, sizeof(LV2UI_Bridge_Control) * num_ports);
+        if (packed == NULL)
+            return false;
+
+        controls->packed = packed;
+
+        memset(ports + controls->num_ports, 0, sizeof(LV2UI_Control_Port) * (num_ports - controls->num_ports));
+        controls->num_ports = num_ports;
+    }
+
+    LV2UI_Control_Port* const port = &controls->ports[port_index];
+    port->value = value;
+    port->known = true;
+
+    if (! port->dirty)
+    {
+        port->dirty = true;
+        controls->dirty_list[controls->num_dirty++] = port_index;
+    }
+
+    return true;
+}
+
+// mark every known port as dirty, so that the next batches send the full state
+static inline
+void lv2ui_controls_mark_all(LV2UI_Controls* const controls)
+{
+    for (uint32_t i = 0; i < controls->num_ports; ++i)
+    {
+        LV2UI_Control_Port* const port = &controls->ports[i];
+
+        if (port->known && ! port->dirty)
+        {
+            port->dirty = true;
+            controls->dirty_list[controls->num_dirty++] = i;
+        }
+    }
+}
+
+// pack the first ports of the dirty list, as many as fit in a message that always goes through the ring.
+// returns the amount of ports packed, to be given to lv2ui_controls_pop once sent.
+static inline
+uint32_t lv2ui_controls_pack(LV2UI_Controls* const controls, const ipc_ring_t* const ring)
+{
+    const uint32_t max_size = ring->size / IPC_OVERFLOW_RING_FRACTION - sizeof(ipc_ring_msg_t);
+    const uint32_t max_count = max_size / sizeof(LV2UI_Bridge_Control);
+    const uint32_t count = controls->num_dirty < max_count ? controls->num_dirty : max_count;
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const uint32_t port_index = controls->dirty_list[i];
+        controls->packed[i].port_index = port_index;
+        controls->packed[i].value = controls->ports[port_index].value;
+    }
+
+    return count;
+}
+
+// mark the first `count` ports of the dirty list as sent
+static inline
+void lv2ui_controls_pop(LV2UI_Controls* const controls, const uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i)
+        controls->ports[controls->dirty_list[i]].dirty = false;
+
+    controls->num_dirty -= count;
+    memmove(controls->dirty_list, controls->dirty_list + count, sizeof(uint32_t) * controls->num_dirty);
+}
+
+static inline
+void lv2ui_controls_cleanup(LV2UI_Controls* const controls)
+{
+    free(controls->ports);
+    free(controls->dirty_list);
+    free(controls->packed);
+}
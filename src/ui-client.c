@@ -3,41 +3,140 @@
 
 #define IPC_LOG_NAME "ipc-client"
 #include "ui-base.h"
+#include "lv2-gtk-ui-bridge.h"
 
+#include <dirent.h>
 #include <dlfcn.h>
-// NOTE cannot use C11 threads as it very poorly supported
-#include <pthread.h>
+#include <limits.h>
+#include <sys/stat.h>
 
+#include <glib-unix.h>
 #include <gtk/gtk.h>
 #ifdef UI_GTK3
 #include <gtk/gtkx.h>
 #endif
 #include <lilv/lilv.h>
+#include <lv2/atom/atom.h>
+#include <lv2/patch/patch.h>
 #include <X11/Xlib.h>
 
 typedef struct {
     char* bundlepath;
+    char* binarypath;
     void* lib;
     const LV2UI_Descriptor* desc;
+    uint32_t desc_index;
+    // NUL-terminated URIs declared by the plugin, mapped in one batch before instantiating the UI
+    char* uris;
+    uint32_t uris_size;
 } LV2UI_Object;
 
 typedef struct {
-    char** uris;
+    uint32_t hash;
+    uint32_t urid;
+    uint32_t offset;
+} LV2UI_URI_Entry;
+
+// open-addressing hash table of known URIDs, URI strings are interned in a single arena
+typedef struct {
+    LV2UI_URI_Entry* entries;
+    uint32_t num_entries;
+    uint32_t num_used;
+    char* arena;
+    uint32_t arena_size;
+    uint32_t arena_used;
     const char* waiting_uri;
-    uint32_t max_urid;
 } LV2UI_URIs;
 
-typedef struct {
+typedef struct LV2UI_Bridge {
     ipc_client_t* ipc;
     LV2UI_Object* uiobj;
     LV2UI_Handle uihandle;
     LV2UI_URIs uiuris;
+    uint32_t idle_depth;
+    LV2UI_Controls controls;
+    uint32_t write_interval;
+    guint write_timer;
+    char* uri;
+    GtkWidget* window;
+    guint notify_source;
+    // host asked to close this UI, see lv2ui_message_detach
+    bool detaching;
+    LV2_URID_Map urid_map;
+    LV2_Feature feature_urid_map;
+    // host display data mirrored into shared memory, requested on first read
+    LV2_GTK_UI_Bridge_Display_Data display_data;
+    LV2_Feature feature_display_data;
+    ipc_snapshot_reader_t display;
+    bool display_requested;
+    const LV2_Feature* features[3];
+    // next UI hosted by the same process, when running in shared mode
+    struct LV2UI_Bridge* next;
 } LV2UI_Bridge;
 
-static LV2UI_Object* lv2ui_object_load(const char* const uri)
+// UIs hosted by this process, when running in shared mode
+static LV2UI_Bridge* lv2ui_bridges = NULL;
+
+static volatile sig_atomic_t lv2ui_quit = 0;
+
+static void lv2ui_append_uris(char** const uris, uint32_t* const uris_size, LilvNodes* const nodes)
+{
+    if (nodes == NULL)
+        return;
+
+    LILV_FOREACH(nodes, i, nodes)
+    {
+        const LilvNode* const node = lilv_nodes_get(nodes, i);
+
+        if (! lilv_node_is_uri(node))
+            continue;
+
+        const char* const uri = lilv_node_as_uri(node);
+        const uint32_t uri_size = strlen(uri) + 1;
+
+        char* const newuris = realloc(*uris, *uris_size + uri_size);
+        if (newuris == NULL)
+            break;
+
+        memcpy(newuris + *uris_size, uri, uri_size);
+        *uris = newuris;
+        *uris_size += uri_size;
+    }
+
+    lilv_nodes_free(nodes);
+}
+
+static LV2UI_Object* lv2ui_object_new(const char* const binarypath,
+                                       void* const lib,
+                                       const LV2UI_Descriptor* const desc,
+                                       const uint32_t desc_index,
+                                       char* const uris,
+                                       const uint32_t uris_size)
+{
+    const char* const sep = strrchr(binarypath, '/');
+    const size_t bundlepath_len = sep != NULL ? (size_t)(sep - binarypath) + 1 : 0;
+
+    LV2UI_Object* const uiobj = malloc(sizeof(LV2UI_Object));
+    uiobj->bundlepath = malloc(bundlepath_len + 1);
+    uiobj->binarypath = strdup(binarypath);
+    uiobj->lib = lib;
+    uiobj->desc = desc;
+    uiobj->desc_index = desc_index;
+    uiobj->uris = uris;
+    uiobj->uris_size = uris_size;
+
+    memcpy(uiobj->bundlepath, binarypath, bundlepath_len);
+    uiobj->bundlepath[bundlepath_len] = '\0';
+
+    fprintf(stderr, "bundlepath is '%s'\n", uiobj->bundlepath);
+
+    return uiobj;
+}
+
+static LV2UI_Object* lv2ui_object_load_from_world(LilvWorld* const world, const char* const uri)
 {
-    LilvWorld* const world = lilv_world_new();
-    lilv_world_load_all(world);
+    char* uris = NULL;
+    uint32_t uris_size = 0;
 
     const LilvPlugins* const plugins = lilv_world_get_all_plugins(world);
     LilvNode* const urinode = lilv_new_uri(world, uri);
@@ -49,6 +148,25 @@ static LV2UI_Object* lv2ui_object_load(const char* const uri)
     if (plugin == NULL)
         goto error;
 
+    {
+        LilvNode* const readable = lilv_new_uri(world, LV2_PATCH__readable);
+        LilvNode* const writable = lilv_new_uri(world, LV2_PATCH__writable);
+        LilvNode* const supports = lilv_new_uri(world, LV2_ATOM__supports);
+
+        lv2ui_append_uris(&uris, &uris_size, lilv_plugin_get_value(plugin, readable));
+        lv2ui_append_uris(&uris, &uris_size, lilv_plugin_get_value(plugin, writable));
+
+        for (uint32_t i = 0, count = lilv_plugin_get_num_ports(plugin); i < count; ++i)
+        {
+            const LilvPort* const port = lilv_plugin_get_port_by_index(plugin, i);
+            lv2ui_append_uris(&uris, &uris_size, lilv_port_get_value(plugin, port, supports));
+        }
+
+        lilv_node_free(readable);
+        lilv_node_free(writable);
+        lilv_node_free(supports);
+    }
+
     LilvUIs* const uis = lilv_plugin_get_uis(plugin);
     if (uis == NULL)
         goto error;
@@ -61,9 +179,10 @@ static LV2UI_Object* lv2ui_object_load(const char* const uri)
     if (gtkuinode == NULL)
         goto error;
 
-    char* bundlepath;
+    char* binarypath = NULL;
     void* uilib = NULL;
     const LV2UI_Descriptor* uidesc = NULL;
+    uint32_t uidesc_index = 0;
 
     LILV_FOREACH(uis, i, uis)
     {
@@ -73,7 +192,7 @@ static LV2UI_Object* lv2ui_object_load(const char* const uri)
             continue;
 
         const LilvNode* const bundlenode = lilv_ui_get_binary_uri(ui);
-        char* const binarypath = lilv_file_uri_parse(lilv_node_as_uri(bundlenode), NULL);
+        binarypath = lilv_file_uri_parse(lilv_node_as_uri(bundlenode), NULL);
 
         uilib = dlopen(binarypath, RTLD_NOW);
 
@@ -81,6 +200,7 @@ static LV2UI_Object* lv2ui_object_load(const char* const uri)
         {
             fprintf(stderr, "could not load UI binary: %s\n", dlerror());
             lilv_free(binarypath);
+            binarypath = NULL;
             continue;
         }
 
@@ -103,7 +223,10 @@ static LV2UI_Object* lv2ui_object_load(const char* const uri)
                 }
 
                 if (strcmp(uidesc->URI, lilv_node_as_uri(lilv_ui_get_uri(ui))) == 0)
+                {
+                    uidesc_index = j;
                     break;
+                }
 
                 fprintf(stderr, "skip lv2 ui %s\n", uidesc->URI);
             }
@@ -114,15 +237,10 @@ static LV2UI_Object* lv2ui_object_load(const char* const uri)
         }
 
         if (uidesc != NULL)
-        {
-            bundlepath = binarypath;
-            char* const sep = strrchr(bundlepath, '/');
-            if (sep != NULL)
-                sep[1] = '\0';
             break;
-        }
 
         lilv_free(binarypath);
+        binarypath = NULL;
 
         if (uilib != NULL)
         {
@@ -134,348 +252,1366 @@ static LV2UI_Object* lv2ui_object_load(const char* const uri)
     if (uilib == NULL || uidesc == NULL)
         goto error;
 
-    LV2UI_Object* const uiobj = malloc(sizeof(LV2UI_Object));
-    uiobj->bundlepath = bundlepath;
-    uiobj->lib = uilib;
-    uiobj->desc = uidesc;
-
-    fprintf(stderr, "bundlepath is '%s'\n", bundlepath);
-
+    LV2UI_Object* const uiobj = lv2ui_object_new(binarypath, uilib, uidesc, uidesc_index, uris, uris_size);
+    lilv_free(binarypath);
     return uiobj;
 
 error:
-    lilv_world_free(world);
+    free(uris);
     return NULL;
 }
 
-static void lv2ui_object_unload(LV2UI_Object* const uiobj)
+static char* lv2ui_read_file(const char* const path)
 {
-    lilv_free(uiobj->bundlepath);
-
-    if (uiobj->lib != NULL)
-        dlclose(uiobj->lib);
+    FILE* const f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
 
-    free(uiobj);
-}
+    char* data = NULL;
 
-static void lv2ui_uris_add(LV2UI_URIs* const uiuris, const uint32_t urid, const char* const uri)
-{
-    if (urid >= uiuris->max_urid)
+    if (fseek(f, 0, SEEK_END) == 0)
     {
-        uiuris->uris = realloc(uiuris->uris, sizeof(char*) * (urid + 1));
+        const long size = ftell(f);
 
-        for (uint32_t i = uiuris->max_urid; i < urid + 1; ++i)
-            uiuris->uris[i] = NULL;
-
-        uiuris->max_urid = urid + 1;
+        if (size > 0 && fseek(f, 0, SEEK_SET) == 0 && (data = malloc(size + 1)) != NULL)
+        {
+            if (fread(data, 1, size, f) == (size_t)size)
+            {
+                data[size] = '\0';
+            }
+            else
+            {
+                free(data);
+                data = NULL;
+            }
+        }
     }
 
-    assert(uiuris->uris[urid] == NULL);
-    uiuris->uris[urid] = strdup(uri);
+    fclose(f);
+    return data;
 }
 
-static void lv2ui_uris_cleanup(LV2UI_URIs* const uiuris)
+// load only bundles whose manifest mentions the plugin URI or its namespace, returns false if none does
+static bool lv2ui_world_load_bundles_for(LilvWorld* const world, const char* const uri)
 {
-    for (uint32_t i = 0; i < uiuris->max_urid; ++i)
-        free(uiuris->uris[i]);
-}
+    const char* lv2path = getenv("LV2_PATH");
+    if (lv2path == NULL)
+       #ifdef __APPLE__
+        lv2path = "~/Library/Audio/Plug-Ins/LV2:~/.lv2:/usr/local/lib/lv2:/usr/lib/lv2:/Library/Audio/Plug-Ins/LV2";
+       #else
+        lv2path = "~/.lv2:/usr/lib/lv2:/usr/local/lib/lv2";
+       #endif
 
-static void lv2ui_write_function(LV2UI_Controller controller,
-                                 uint32_t port_index,
-                                 uint32_t buffer_size,
-                                 uint32_t format,
-                                 const void* buffer)
-{
-    LV2UI_Bridge* const bridge = controller;
+    const char* const home = getenv("HOME");
 
-    const uint32_t msg_type = lv2ui_message_port_event;
-    ipc_client_write(bridge->ipc, &msg_type, sizeof(uint32_t)) &&
-    ipc_client_write(bridge->ipc, &port_index, sizeof(uint32_t)) &&
-    ipc_client_write(bridge->ipc, &buffer_size, sizeof(uint32_t)) &&
-    ipc_client_write(bridge->ipc, &format, sizeof(uint32_t)) &&
-    ipc_client_write(bridge->ipc, buffer, buffer_size);
-    ipc_client_commit(bridge->ipc);
-}
+    // full URI, as in <http://example.org/plugins/name>
+    const size_t uri_len = strlen(uri);
+    char* const uri_needle = malloc(uri_len + 3);
+    snprintf(uri_needle, uri_len + 3, "<%s>", uri);
 
-static int lv2ui_idle(void* const ptr)
-{
-    LV2UI_Bridge* const bridge = ptr;
+    // namespace for prefixed names, as in @prefix ex: <http://example.org/plugins/>
+    size_t ns_len = uri_len;
+    while (ns_len != 0 && uri[ns_len - 1] != '/' && uri[ns_len - 1] != '#')
+        --ns_len;
 
-    uint32_t size = 0;
-    void* buffer = NULL;
+    char* const ns_needle = malloc(ns_len + 3);
+    snprintf(ns_needle, ns_len + 3, "<%.*s>", (int)ns_len, uri);
+
+    bool found = false;
 
-    while (ipc_client_read_size(bridge->ipc) != 0)
+    for (const char* dir = lv2path; *dir != '\0';)
     {
-        uint32_t msg_type = lv2ui_message_null;
-        if (ipc_client_read(bridge->ipc, &msg_type, sizeof(uint32_t)))
+        const char* const sep = strchr(dir, ':');
+        const size_t dir_len = sep != NULL ? (size_t)(sep - dir) : strlen(dir);
+
+        char dirpath[PATH_MAX];
+        if (dir[0] == '~' && home != NULL)
+            snprintf(dirpath, sizeof(dirpath), "%s%.*s", home, (int)dir_len - 1, dir + 1);
+        else
+            snprintf(dirpath, sizeof(dirpath), "%.*s", (int)dir_len, dir);
+
+        dir += dir_len;
+        if (*dir == ':')
+            ++dir;
+
+        DIR* const d = opendir(dirpath);
+        if (d == NULL)
+            continue;
+
+        for (struct dirent* entry; (entry = readdir(d)) != NULL;)
         {
-            uint32_t port_index, buffer_size, format;
-            switch (msg_type)
+            const size_t name_len = strlen(entry->d_name);
+            if (name_len < 5 || strcmp(entry->d_name + name_len - 4, ".lv2") != 0)
+                continue;
+
+            char path[PATH_MAX];
+            const int ret = snprintf(path, sizeof(path), "%s/%s/manifest.ttl", dirpath, entry->d_name);
+            if (ret < 0 || (size_t)ret >= sizeof(path))
+                continue;
+
+            char* const manifest = lv2ui_read_file(path);
+            if (manifest == NULL)
+                continue;
+
+            if (strstr(manifest, uri_needle) != NULL || (ns_len != 0 && strstr(manifest, ns_needle) != NULL))
             {
-            case lv2ui_message_port_event:
-                if (ipc_client_read(bridge->ipc, &port_index, sizeof(uint32_t)) &&
-                    ipc_client_read(bridge->ipc, &buffer_size, sizeof(uint32_t)) &&
-                    ipc_client_read(bridge->ipc, &format, sizeof(uint32_t)))
-                {
-                    if (buffer_size > size)
-                    {
-                        size = buffer_size;
-                        buffer = realloc(buffer, buffer_size);
-
-                        if (buffer == NULL)
-                        {
-                            fprintf(stderr, "lv2ui client out of memory, abort!\n");
-                            abort();
-                        }
-                    }
-
-                    if (ipc_client_read(bridge->ipc, buffer, buffer_size))
-                    {
-                        if (bridge->uiobj->desc->port_event != NULL)
-                            bridge->uiobj->desc->port_event(bridge->uihandle, port_index, buffer_size, format, buffer);
-
-                        continue;
-                    }
-                }
-                break;
-            case lv2ui_message_urid_map_resp:
-                if (ipc_client_read(bridge->ipc, &port_index, sizeof(uint32_t)) &&
-                    ipc_client_read(bridge->ipc, &buffer_size, sizeof(uint32_t)))
-                {
-                    if (buffer_size > size)
-                    {
-                        size = buffer_size;
-                        buffer = realloc(buffer, buffer_size);
-
-                        if (buffer == NULL)
-                        {
-                            fprintf(stderr, "lv2ui client out of memory, abort!\n");
-                            abort();
-                        }
-                    }
-
-                    if (ipc_client_read(bridge->ipc, buffer, buffer_size))
-                    {
-                        lv2ui_uris_add(&bridge->uiuris, port_index, buffer);
-
-                        if (bridge->uiuris.waiting_uri != NULL && strcmp(bridge->uiuris.waiting_uri, buffer) == 0)
-                            bridge->uiuris.waiting_uri = NULL;
-
-                        continue;
-                    }
-                }
-                break;
+                // bundle URIs need a trailing separator
+                path[strlen(path) - strlen("manifest.ttl")] = '\0';
+
+                LilvNode* const bundlenode = lilv_new_file_uri(world, NULL, path);
+                lilv_world_load_bundle(world, bundlenode);
+                lilv_node_free(bundlenode);
+
+                found = true;
             }
+
+            free(manifest);
         }
 
-        fprintf(stderr, "lv2ui client ringbuffer data race, abort!\n");
-        abort();
+        closedir(d);
     }
 
-    free(buffer);
-
-    return 0;
+    free(uri_needle);
+    free(ns_needle);
+    return found;
 }
 
-static LV2_URID lv2ui_uri_map(const LV2_URID_Map_Handle handle, const char* const uri)
+// on-disk index of resolved UIs, so repeated opens skip lilv and the descriptor scan entirely
+#define LV2UI_CACHE_MAGIC "LV2GTKUI"
+#define LV2UI_CACHE_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_records;
+} LV2UI_Cache_Header;
+
+// followed by NUL-terminated plugin URI, binary path and UI URI, then the declared URIs, padded to 8 bytes
+typedef struct {
+    uint32_t size;
+    uint32_t desc_index;
+    int64_t binary_mtime;
+    int64_t ttl_mtime;
+    uint32_t uri_size;
+    uint32_t binarypath_size;
+    uint32_t uiuri_size;
+    uint32_t uris_size;
+} LV2UI_Cache_Record;
+
+static char* lv2ui_cache_path(const bool create_dir)
 {
-    LV2UI_Bridge* const bridge = handle;
+    const char* const xdg_cache_home = getenv("XDG_CACHE_HOME");
+    const char* const home = getenv("HOME");
+
+    char dirpath[PATH_MAX];
+    if (xdg_cache_home != NULL && xdg_cache_home[0] == '/')
+        snprintf(dirpath, sizeof(dirpath), "%s/lv2-gtk-ui-bridge", xdg_cache_home);
+    else if (home != NULL)
+        snprintf(dirpath, sizeof(dirpath), "%s/.cache/lv2-gtk-ui-bridge", home);
+    else
+        return NULL;
 
-    for (uint32_t i = 0; i < bridge->uiuris.max_urid; ++i)
+    if (create_dir)
     {
-        if (bridge->uiuris.uris[i] != NULL && strcmp(bridge->uiuris.uris[i], uri) == 0)
-            return i;
+        char* const sep = strrchr(dirpath, '/');
+        *sep = '\0';
+        mkdir(dirpath, 0755);
+        *sep = '/';
+        mkdir(dirpath, 0755);
     }
 
-    bridge->uiuris.waiting_uri = uri;
+    char path[PATH_MAX];
+   #ifdef UI_GTK3
+    const int ret = snprintf(path, sizeof(path), "%s/gtk3.cache", dirpath);
+   #else
+    const int ret = snprintf(path, sizeof(path), "%s/gtk2.cache", dirpath);
+   #endif
 
-    const uint32_t msg_type = lv2ui_message_urid_map_req;
-    const uint32_t buffer_size = strlen(uri) + 1;
-    ipc_client_write(bridge->ipc, &msg_type, sizeof(uint32_t)) &&
-    ipc_client_write(bridge->ipc, &buffer_size, sizeof(uint32_t)) &&
-    ipc_client_write(bridge->ipc, uri, buffer_size);
-    ipc_client_commit(bridge->ipc);
+    if (ret < 0 || (size_t)ret >= sizeof(path))
+        return NULL;
 
-    while (ipc_client_wait_secs(bridge->ipc, 1) && lv2ui_idle(bridge) == 0 && bridge->uiuris.waiting_uri != NULL) {}
+    return strdup(path);
+}
+
+static int64_t lv2ui_cache_mtime(const char* const path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (int64_t)st.st_mtime : -1;
+}
+
+// newest mtime of the turtle files next to the UI binary, the URI list can come from any of them (rdfs:seeAlso)
+static int64_t lv2ui_cache_ttl_mtime(const char* const binarypath)
+{
+    char dirpath[PATH_MAX];
+    const char* const sep = strrchr(binarypath, '/');
+    snprintf(dirpath, sizeof(dirpath), "%.*s", sep != NULL ? (int)(sep - binarypath) : 1, sep != NULL ? binarypath : ".");
+
+    DIR* const dir = opendir(dirpath);
+    if (dir == NULL)
+        return -1;
 
-    for (uint32_t i = 0; i < bridge->uiuris.max_urid; ++i)
+    int64_t newest = -1;
+    char path[PATH_MAX];
+
+    for (struct dirent* entry; (entry = readdir(dir)) != NULL;)
     {
-        if (bridge->uiuris.uris[i] != NULL && strcmp(bridge->uiuris.uris[i], uri) == 0)
-            return i;
+        const size_t len = strlen(entry->d_name);
+        if (len < 4 || strcmp(entry->d_name + len - 4, ".ttl") != 0)
+            continue;
+
+        const int ret = snprintf(path, sizeof(path), "%s/%s", dirpath, entry->d_name);
+        if (ret < 0 || (size_t)ret >= sizeof(path))
+            continue;
+
+        const int64_t mtime = lv2ui_cache_mtime(path);
+        if (mtime > newest)
+            newest = mtime;
     }
 
-    fprintf(stderr, "lv2ui client uri map failed\n");
-    return 0;
+    closedir(dir);
+    return newest;
 }
 
-static void* lv2ui_thread_run(void* const ptr)
+// get the next valid record, returns NULL once past the last one
+static const LV2UI_Cache_Record* lv2ui_cache_next(const uint8_t* const data,
+                                                  const size_t size,
+                                                  size_t* const offset)
 {
-    LV2UI_Bridge* const bridge = ptr;
+    if (*offset + sizeof(LV2UI_Cache_Record) > size)
+        return NULL;
 
-    while (bridge->ipc != NULL)
-    {
-        if (ipc_client_wait_secs(bridge->ipc, 1))
-            g_main_context_invoke(NULL, lv2ui_idle, bridge);
-    }
+    const LV2UI_Cache_Record* const record = (const LV2UI_Cache_Record*)(data + *offset);
+    const uint64_t strings_size = (uint64_t)record->uri_size + record->binarypath_size + record->uiuri_size + record->uris_size;
 
-    return NULL;
+    if (record->size % 8 != 0
+        || record->size < sizeof(LV2UI_Cache_Record) + strings_size
+        || record->size > size - *offset
+        || record->uri_size == 0 || record->binarypath_size == 0 || record->uiuri_size == 0)
+        return NULL;
+
+    const char* const strings = (const char*)(record + 1);
+
+    if (strings[record->uri_size - 1] != '\0'
+        || strings[record->uri_size + record->binarypath_size - 1] != '\0'
+        || strings[record->uri_size + record->binarypath_size + record->uiuri_size - 1] != '\0'
+        || (record->uris_size != 0 && strings[strings_size - 1] != '\0'))
+        return NULL;
+
+    *offset += record->size;
+    return record;
 }
 
-static void signal_handler(const int sig)
+// number of valid records, a file cut short or written partially does not match its header
+static uint32_t lv2ui_cache_count(const uint8_t* const data, const size_t size)
 {
-    gtk_main_quit();
+    uint32_t count = 0;
+    size_t offset = sizeof(LV2UI_Cache_Header);
 
-    // unused
-    (void)sig;
+    while (lv2ui_cache_next(data, size, &offset) != NULL)
+        ++count;
+
+    return offset == size ? count : UINT32_MAX;
 }
 
-int main(int argc, char* argv[])
+// map the whole cache file read-only, returns NULL if missing or not valid
+static const uint8_t* lv2ui_cache_map(const char* const path, size_t* const size)
 {
-    if (! gtk_init_check(&argc, &argv))
-    {
-        fprintf(stderr, "could not init gtk, cannot continue!\n");
-        return 1;
-    }
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
 
-    if (argc != 2 && argc != 4)
-    {
-        fprintf(stderr, "usage: %s <lv2-uri> [shm-access-key] [x11-ui-parent]\n", argv[0]);
-        return 1;
-    }
+    struct stat st;
+    void* ptr = MAP_FAILED;
 
-    struct sigaction sig = { 0 };
-    sig.sa_handler = signal_handler;
-    sig.sa_flags = SA_RESTART;
-    sigemptyset(&sig.sa_mask);
-    sigaction(SIGTERM, &sig, NULL);
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(LV2UI_Cache_Header))
+        ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-    const char* const uri = argv[1];
-    const char* const shm = argc == 4 ? argv[2] : NULL;
-    const char* const wid = argc == 4 ? argv[3] : NULL;
+    close(fd);
 
-    LV2UI_Bridge bridge = { 0 };
+    if (ptr == MAP_FAILED)
+        return NULL;
+
+    const LV2UI_Cache_Header* const header = ptr;
 
-    bridge.uiobj = lv2ui_object_load(uri);
-    if (bridge.uiobj == NULL)
+    if (memcmp(header->magic, LV2UI_CACHE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != LV2UI_CACHE_VERSION
+        || lv2ui_cache_count(ptr, st.st_size) != header->num_records)
     {
-        fprintf(stderr, "lv2ui failed to load UI details, cannot continue!\n");
-        return 1;
+        munmap(ptr, st.st_size);
+        return NULL;
     }
 
-    if (shm != NULL)
-    {
-        bridge.ipc = ipc_client_attach(shm, rbsize);
-        if (bridge.ipc == NULL)
-            goto fail;
+    *size = st.st_size;
+    return ptr;
+}
 
-        assert(bridge.ipc->ring_send->size != 0);
-        assert(bridge.ipc->ring_recv->size != 0);
-    }
+static LV2UI_Object* lv2ui_cache_load(const char* const uri)
+{
+    char* const path = lv2ui_cache_path(false);
+    if (path == NULL)
+        return NULL;
 
-    // FIXME hexa create shm
-    const long long winId = wid != NULL ? atoll(wid) : 0;
+    size_t size;
+    const uint8_t* const data = lv2ui_cache_map(path, &size);
+    free(path);
 
-    // create plug window
-    GtkWidget* const window =
-       #ifndef __APPLE__
-        winId != 0 ? gtk_plug_new(winId) :
-       #endif
-        gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    if (data == NULL)
+        return NULL;
 
-    if (window == NULL)
-    {
-        fprintf(stderr, "gtk window creation fail, cannot continue!\n");
-        return 1;
-    }
+    LV2UI_Object* uiobj = NULL;
+    size_t offset = sizeof(LV2UI_Cache_Header);
 
-    LV2UI_Widget widget = NULL;
-    LV2_URID_Map urid_map = { .handle = &bridge, .map = lv2ui_uri_map };
-    const LV2_Feature feature_urid_map = { .URI = LV2_URID__map, .data = &urid_map };
-    const LV2_Feature* features[] = {
-        &feature_urid_map,
-        NULL
-    };
-    bridge.uihandle = bridge.uiobj->desc->instantiate(bridge.uiobj->desc,
-                                                      uri,
-                                                      bridge.uiobj->bundlepath,
-                                                      lv2ui_write_function,
-                                                      &bridge,
-                                                      &widget,
-                                                      features);
-
-    if (bridge.uihandle == NULL)
+    for (const LV2UI_Cache_Record* record; (record = lv2ui_cache_next(data, size, &offset)) != NULL;)
     {
-        fprintf(stderr, "lv2ui failed to initialize, cannot continue!\n");
-        goto fail;
+        const char* const recuri = (const char*)(record + 1);
+
+        if (strcmp(recuri, uri) != 0)
+            continue;
+
+        const char* const binarypath = recuri + record->uri_size;
+        const char* const uiuri = binarypath + record->binarypath_size;
+        const char* const uris = uiuri + record->uiuri_size;
+
+        // stale, plugin was updated or removed
+        if (lv2ui_cache_mtime(binarypath) != record->binary_mtime
+            || lv2ui_cache_ttl_mtime(binarypath) != record->ttl_mtime)
+            break;
+
+        void* const uilib = dlopen(binarypath, RTLD_NOW);
+        if (uilib == NULL)
+            break;
+
+        const LV2UI_DescriptorFunction lv2uifn = dlsym(uilib, "lv2ui_descriptor");
+        const LV2UI_Descriptor* const uidesc = lv2uifn != NULL ? lv2uifn(record->desc_index) : NULL;
+
+        if (uidesc == NULL
+            || uidesc->instantiate == NULL
+            || uidesc->cleanup == NULL
+            || strcmp(uidesc->URI, uiuri) != 0)
+        {
+            dlclose(uilib);
+            break;
+        }
+
+        char* const uriscopy = record->uris_size != 0 ? malloc(record->uris_size) : NULL;
+        if (uriscopy != NULL)
+            memcpy(uriscopy, uris, record->uris_size);
+
+        uiobj = lv2ui_object_new(binarypath, uilib, uidesc, record->desc_index,
+                                 uriscopy, uriscopy != NULL ? record->uris_size : 0);
+        break;
     }
 
-    if (widget == NULL)
+    munmap((void*)data, size);
+    return uiobj;
+}
+
+static void lv2ui_cache_store(const char* const uri, const LV2UI_Object* const uiobj)
+{
+    char* const path = lv2ui_cache_path(true);
+    if (path == NULL)
+        return;
+
+    const size_t tmppath_size = strlen(path) + 8;
+    char* const tmppath = malloc(tmppath_size);
+    snprintf(tmppath, tmppath_size, "%s.XXXXXX", path);
+
+    const int fd = mkstemp(tmppath);
+    FILE* const f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+
+    if (f == NULL)
     {
-        fprintf(stderr, "lv2ui failed to provide a gtk2 widget, cannot continue!\n");
-        bridge.uiobj->desc->cleanup(bridge.uihandle);
-        goto fail;
+        if (fd >= 0)
+            close(fd);
+        goto end;
     }
 
-    gtk_container_add(GTK_CONTAINER(window), GTK_WIDGET(widget));
+    static const uint8_t padding[8] = { 0 };
+    LV2UI_Cache_Header header = { LV2UI_CACHE_MAGIC, LV2UI_CACHE_VERSION, 1 };
 
-    // handle any pending events before showing window
-    lv2ui_idle(&bridge);
+    // record count is rewritten once the old records are copied over
+    fwrite(&header, sizeof(header), 1, f);
 
-   #ifndef __APPLE__
-    if (winId != 0)
     {
-        gtk_widget_show_all(window);
+        const uint32_t uri_size = strlen(uri) + 1;
+        const uint32_t binarypath_size = strlen(uiobj->binarypath) + 1;
+        const uint32_t uiuri_size = strlen(uiobj->desc->URI) + 1;
+        const uint32_t strings_size = uri_size + binarypath_size + uiuri_size + uiobj->uris_size;
+
+        const LV2UI_Cache_Record record = {
+            .size = (sizeof(LV2UI_Cache_Record) + strings_size + 7) & ~7u,
+            .desc_index = uiobj->desc_index,
+            .binary_mtime = lv2ui_cache_mtime(uiobj->binarypath),
+            .ttl_mtime = lv2ui_cache_ttl_mtime(uiobj->binarypath),
+            .uri_size = uri_size,
+            .binarypath_size = binarypath_size,
+            .uiuri_size = uiuri_size,
+            .uris_size = uiobj->uris_size,
+        };
+
+        fwrite(&record, sizeof(record), 1, f);
+        fwrite(uri, uri_size, 1, f);
+        fwrite(uiobj->binarypath, binarypath_size, 1, f);
+        fwrite(uiobj->desc->URI, uiuri_size, 1, f);
+        if (uiobj->uris_size != 0)
+            fwrite(uiobj->uris, uiobj->uris_size, 1, f);
+        fwrite(padding, record.size - sizeof(record) - strings_size, 1, f);
+    }
 
-        const Window win = gtk_plug_get_id(GTK_PLUG(window));
+    // keep every other valid record
+    size_t size;
+    const uint8_t* const data = lv2ui_cache_map(path, &size);
 
-        Display* const display = XOpenDisplay(NULL);
-        if (display != NULL)
-        {
-            XMapWindow(display, win);
-            XFlush(display);
-            XCloseDisplay(display);
-        }
+    if (data != NULL)
+    {
+        size_t offset = sizeof(LV2UI_Cache_Header);
 
-        // pass child window id to server side
-        if (bridge.ipc != NULL)
+        for (const LV2UI_Cache_Record* record; (record = lv2ui_cache_next(data, size, &offset)) != NULL;)
         {
-            const uint32_t msg_type = lv2ui_message_window_id;
-            const uint64_t window_id = win;
-            ipc_client_write(bridge.ipc, &msg_type, sizeof(uint32_t)) &&
-            ipc_client_write(bridge.ipc, &window_id, sizeof(uint64_t));
-            ipc_client_commit(bridge.ipc);
+            if (strcmp((const char*)(record + 1), uri) == 0)
+                continue;
+
+            fwrite(record, record->size, 1, f);
+            ++header.num_records;
         }
+
+        munmap((void*)data, size);
     }
-    else
-   #endif
-    if (shm == NULL)
-    {
-        g_signal_connect(G_OBJECT(window), "destroy", G_CALLBACK(gtk_main_quit), NULL);
-        gtk_widget_show_all(window);
-    }
 
-    pthread_t thread = { 0 };
-    if (bridge.ipc != NULL)
+    fseek(f, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, f);
+
+    // replace atomically, other helpers may be reading the old file
+    if (fclose(f) != 0 || rename(tmppath, path) != 0)
+        unlink(tmppath);
+
+end:
+    free(tmppath);
+    free(path);
+}
+
+static LV2UI_Object* lv2ui_object_load(const char* const uri)
+{
+    LV2UI_Object* uiobj = lv2ui_cache_load(uri);
+    if (uiobj != NULL)
+        return uiobj;
+
+    // try with just the relevant bundles first, loading everything is slow when many plugins are installed
+    LilvWorld* world = lilv_world_new();
+
+    if (lv2ui_world_load_bundles_for(world, uri))
+        uiobj = lv2ui_object_load_from_world(world, uri);
+
+    // plugin or its UI is declared somewhere unexpected, fallback to loading everything
+    if (uiobj == NULL)
     {
-        pthread_create(&thread, NULL, lv2ui_thread_run, &bridge);
+        lilv_world_free(world);
+        world = lilv_world_new();
+        lilv_world_load_all(world);
+
+        uiobj = lv2ui_object_load_from_world(world, uri);
     }
 
-    fprintf(stderr, "gtk ready '%s' %lld\n", shm, winId);
+    lilv_world_free(world);
 
-    gtk_main();
+    if (uiobj != NULL)
+        lv2ui_cache_store(uri, uiobj);
+
+    return uiobj;
+}
+
+static void lv2ui_object_unload(LV2UI_Object* const uiobj)
+{
+    free(uiobj->bundlepath);
+    free(uiobj->binarypath);
+
+    if (uiobj->lib != NULL)
+        dlclose(uiobj->lib);
+
+    free(uiobj->uris);
+    free(uiobj);
+}
+
+static uint32_t lv2ui_uris_hash(const char* const uri)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const char* c = uri; *c != '\0'; ++c)
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    return hash;
+}
+
+static LV2UI_URI_Entry* lv2ui_uris_find(const LV2UI_URIs* const uiuris, const char* const uri, const uint32_t hash)
+{
+    if (uiuris->num_entries == 0)
+        return NULL;
+
+    const uint32_t mask = uiuris->num_entries - 1;
 
-    if (bridge.ipc != NULL)
+    for (uint32_t i = hash & mask;; i = (i + 1) & mask)
     {
-        ipc_client_t* const ipc = bridge.ipc;
-        bridge.ipc = NULL;
-        pthread_join(thread, NULL);
-        ipc_client_dettach(ipc);
+        LV2UI_URI_Entry* const entry = &uiuris->entries[i];
+
+        // empty slot, ends the probe sequence
+        if (entry->urid == 0)
+            return entry;
+
+        if (entry->hash == hash && strcmp(uiuris->arena + entry->offset, uri) == 0)
+            return entry;
     }
+}
 
-    bridge.uiobj->desc->cleanup(bridge.uihandle);
+static LV2_URID lv2ui_uris_lookup(const LV2UI_URIs* const uiuris, const char* const uri)
+{
+    const LV2UI_URI_Entry* const entry = lv2ui_uris_find(uiuris, uri, lv2ui_uris_hash(uri));
+    return entry != NULL ? entry->urid : 0;
+}
+
+static bool lv2ui_uris_add(LV2UI_URIs* const uiuris, const uint32_t urid, const char* const uri)
+{
+    if (urid == 0)
+        return false;
+
+    // keep load factor under 1/2
+    if ((uiuris->num_used + 1) * 2 > uiuris->num_entries)
+    {
+        const uint32_t num_entries = uiuris->num_entries != 0 ? uiuris->num_entries * 2 : 256;
+        LV2UI_URI_Entry* const entries = calloc(num_entries, sizeof(LV2UI_URI_Entry));
+        if (entries == NULL)
+            return false;
+
+        const uint32_t mask = num_entries - 1;
+
+        for (uint32_t i = 0; i < uiuris->num_entries; ++i)
+        {
+            const LV2UI_URI_Entry* const entry = &uiuris->entries[i];
+            if (entry->urid == 0)
+                continue;
+
+            uint32_t j = entry->hash & mask;
+            while (entries[j].urid != 0)
+                j = (j + 1) & mask;
+
+            entries[j] = *entry;
+        }
+
+        free(uiuris->entries);
+        uiuris->entries = entries;
+        uiuris->num_entries = num_entries;
+    }
+
+    const uint32_t hash = lv2ui_uris_hash(uri);
+    LV2UI_URI_Entry* const entry = lv2ui_uris_find(uiuris, uri, hash);
+
+    // already known
+    if (entry->urid != 0)
+        return true;
+
+    const uint32_t uri_size = strlen(uri) + 1;
+
+    if (uiuris->arena_used + uri_size > uiuris->arena_size)
+    {
+        uint32_t arena_size = uiuris->arena_size != 0 ? uiuris->arena_size * 2 : 16384;
+        while (uiuris->arena_used + uri_size > arena_size)
+            arena_size *= 2;
+
+        char* const arena = realloc(uiuris->arena, arena_size);
+        if (arena == NULL)
+            return false;
+
+        uiuris->arena = arena;
+        uiuris->arena_size = arena_size;
+    }
+
+    memcpy(uiuris->arena + uiuris->arena_used, uri, uri_size);
+
+    entry->hash = hash;
+    entry->urid = urid;
+    entry->offset = uiuris->arena_used;
+
+    uiuris->arena_used += uri_size;
+    ++uiuris->num_used;
+    return true;
+}
+
+static void lv2ui_uris_cleanup(LV2UI_URIs* const uiuris)
+{
+    free(uiuris->entries);
+    free(uiuris->arena);
+}
+
+static void lv2ui_controls_flush(LV2UI_Bridge* const bridge)
+{
+    LV2UI_Controls* const controls = &bridge->controls;
+
+    if (controls->num_dirty == 0)
+        return;
+
+    // as few messages as possible, a full refresh of a big UI usually takes a single one
+    while (controls->num_dirty != 0)
+    {
+        const uint32_t count = lv2ui_controls_pack(controls, bridge->ipc->ring_send);
+        const uint32_t size = sizeof(LV2UI_Bridge_Control) * count;
+
+        if (count == 0 || ! ipc_client_write_msg(bridge->ipc, lv2ui_message_controls, NULL, 0, controls->packed, size))
+            break;
+
+        lv2ui_controls_pop(controls, count);
+    }
+
+    // ring is full, whatever did not fit is sent on the next flush with its latest value
+    ipc_client_commit(bridge->ipc);
+}
+
+static gboolean lv2ui_write_timer(void* const ptr)
+{
+    LV2UI_Bridge* const bridge = ptr;
+
+    lv2ui_controls_flush(bridge);
+
+    // keep sending what is left of large messages split in fragments
+    if (ipc_client_backlog_size(bridge->ipc) != 0)
+        ipc_client_commit(bridge->ipc);
+
+    if (bridge->controls.num_dirty != 0 || ipc_client_backlog_size(bridge->ipc) != 0)
+        return G_SOURCE_CONTINUE;
+
+    bridge->write_timer = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static void lv2ui_write_function(LV2UI_Controller controller,
+                                 uint32_t port_index,
+                                 uint32_t buffer_size,
+                                 uint32_t format,
+                                 const void* buffer)
+{
+    LV2UI_Bridge* const bridge = controller;
+
+    if (bridge->ipc == NULL)
+        return;
+
+    // control ports only need their latest value, coalesce them and send at most once per write interval
+    if (format == 0 && buffer_size == sizeof(float) && bridge->write_interval != 0)
+    {
+        float value;
+        memcpy(&value, buffer, sizeof(float));
+
+        if (lv2ui_controls_set(&bridge->controls, port_index, value))
+        {
+            if (bridge->write_timer == 0)
+                bridge->write_timer = g_timeout_add(bridge->write_interval, lv2ui_write_timer, bridge);
+
+            return;
+        }
+    }
+
+    // keep order between pending control values and anything else
+    lv2ui_controls_flush(bridge);
+
+    if (format == 0 && buffer_size == sizeof(float))
+    {
+        LV2UI_Bridge_Control control = { port_index, 0.f };
+        memcpy(&control.value, buffer, sizeof(float));
+
+        // queue behind values that did not fit before, or keep it pending if it does not fit now.
+        // the write timer sends it later
+        if ((bridge->controls.num_dirty == 0 || ! lv2ui_controls_set(&bridge->controls, port_index, control.value)) &&
+            ! ipc_client_write_msg(bridge->ipc, lv2ui_message_controls, NULL, 0, &control, sizeof(control)))
+            lv2ui_controls_set(&bridge->controls, port_index, control.value);
+    }
+    else
+    {
+        const LV2UI_Bridge_Port_Event event = { port_index, format };
+        ipc_client_write_msg(bridge->ipc, lv2ui_message_port_event, &event, sizeof(event), buffer, buffer_size);
+    }
+
+    ipc_client_commit(bridge->ipc);
+
+    if ((bridge->controls.num_dirty != 0 || ipc_client_backlog_size(bridge->ipc) != 0) && bridge->write_timer == 0)
+        bridge->write_timer = g_timeout_add(bridge->write_interval != 0 ? bridge->write_interval : 16,
+                                            lv2ui_write_timer, bridge);
+}
+
+static gboolean lv2ui_bridge_close_idle(void* ptr);
+
+static int lv2ui_idle(void* const ptr)
+{
+    LV2UI_Bridge* const bridge = ptr;
+
+    // closed or about to be
+    if (bridge->ipc == NULL || bridge->detaching)
+        return 0;
+
+    // messages are used in place, nested calls (e.g. through uri map) must not give their space back yet
+    ++bridge->idle_depth;
+
+    ipc_ring_msg_t msg;
+    for (const uint8_t* data; (data = ipc_client_acquire_msg(bridge->ipc, &msg)) != NULL;)
+    {
+        bool ok = false;
+
+        switch (msg.type)
+        {
+        case lv2ui_message_port_event:
+            if (msg.size >= sizeof(LV2UI_Bridge_Port_Event))
+            {
+                const LV2UI_Bridge_Port_Event* const event = (const LV2UI_Bridge_Port_Event*)data;
+
+                if (bridge->uihandle != NULL && bridge->uiobj->desc->port_event != NULL)
+                    bridge->uiobj->desc->port_event(bridge->uihandle,
+                                                    event->port_index,
+                                                    msg.size - sizeof(LV2UI_Bridge_Port_Event),
+                                                    event->format,
+                                                    data + sizeof(LV2UI_Bridge_Port_Event));
+
+                ok = true;
+            }
+            break;
+        case lv2ui_message_controls:
+            if (msg.size != 0 && msg.size % sizeof(LV2UI_Bridge_Control) == 0)
+            {
+                const LV2UI_Bridge_Control* const values = (const LV2UI_Bridge_Control*)data;
+
+                if (bridge->uihandle != NULL && bridge->uiobj->desc->port_event != NULL)
+                {
+                    for (uint32_t i = 0, count = msg.size / sizeof(LV2UI_Bridge_Control); i < count; ++i)
+                        bridge->uiobj->desc->port_event(bridge->uihandle,
+                                                        values[i].port_index,
+                                                        sizeof(float),
+                                                        0,
+                                                        &values[i].value);
+                }
+
+                ok = true;
+            }
+            break;
+        case lv2ui_message_urid_map_resp:
+            if (msg.size > sizeof(uint32_t) && data[msg.size - 1] == '\0')
+            {
+                uint32_t urid;
+                memcpy(&urid, data, sizeof(uint32_t));
+
+                const char* const uri = (const char*)data + sizeof(uint32_t);
+
+                lv2ui_uris_add(&bridge->uiuris, urid, uri);
+
+                if (bridge->uiuris.waiting_uri != NULL && strcmp(bridge->uiuris.waiting_uri, uri) == 0)
+                    bridge->uiuris.waiting_uri = NULL;
+
+                ok = true;
+            }
+            break;
+        case lv2ui_message_display_data:
+            if (msg.size == sizeof(uint32_t) * 2)
+            {
+                uint32_t region[2];
+                memcpy(region, data, sizeof(region));
+
+                if (! ipc_snapshot_reader_attach(&bridge->display, bridge->ipc->name, region[0], region[1]))
+                    fprintf(stderr, "lv2ui client failed to map display data\n");
+
+                ok = true;
+            }
+            break;
+        case lv2ui_message_detach:
+            // close from the main loop, after anything already queued for this UI
+            bridge->detaching = true;
+            g_idle_add_full(G_PRIORITY_LOW, lv2ui_bridge_close_idle, bridge, NULL);
+            ok = true;
+            break;
+        }
+
+        if (! ok)
+        {
+            fprintf(stderr, "lv2ui client ringbuffer data race, abort!\n");
+            abort();
+        }
+
+        if (bridge->detaching)
+            break;
+    }
+
+    if (--bridge->idle_depth == 0)
+        ipc_client_release_msgs(bridge->ipc);
+
+    return 0;
+}
+
+static LV2_URID lv2ui_uri_map(const LV2_URID_Map_Handle handle, const char* const uri)
+{
+    LV2UI_Bridge* const bridge = handle;
+
+    LV2_URID urid = lv2ui_uris_lookup(&bridge->uiuris, uri);
+    if (urid != 0 || bridge->ipc == NULL)
+        return urid;
+
+    bridge->uiuris.waiting_uri = uri;
+
+    ipc_client_write_msg(bridge->ipc, lv2ui_message_urid_map_req, NULL, 0, uri, strlen(uri) + 1);
+    ipc_client_commit(bridge->ipc);
+    ipc_client_count_roundtrip(bridge->ipc);
+
+    while (ipc_client_wait_secs(bridge->ipc, 1) && lv2ui_idle(bridge) == 0 && bridge->uiuris.waiting_uri != NULL) {}
+
+    urid = lv2ui_uris_lookup(&bridge->uiuris, uri);
+    if (urid != 0)
+        return urid;
+
+    fprintf(stderr, "lv2ui client uri map failed\n");
+    return 0;
+}
+
+static uint32_t lv2ui_display_data_read(const LV2_GTK_UI_Bridge_Display_Data_Handle handle,
+                                        void* const buffer,
+                                        const uint32_t size)
+{
+    LV2UI_Bridge* const bridge = handle;
+
+    if (bridge->ipc == NULL)
+        return 0;
+
+    // the host only starts mirroring once asked, so UIs that never read cost nothing
+    if (! bridge->display_requested)
+    {
+        if (! ipc_client_write_msg(bridge->ipc, lv2ui_message_display_data, NULL, 0, NULL, 0))
+            return 0;
+
+        ipc_client_commit(bridge->ipc);
+        bridge->display_requested = true;
+    }
+
+    return ipc_snapshot_read(&bridge->display, buffer, size);
+}
+
+static void lv2ui_uris_request(LV2UI_Bridge* const bridge, char* const uris, const uint32_t uris_size)
+{
+    // take in URIDs already pushed by the server
+    lv2ui_idle(bridge);
+
+    // only ask for unknown URIs, and not more than what comfortably fits in the ring
+    uint32_t size = 0;
+    const char* last = NULL;
+
+    for (uint32_t offset = 0, uri_size; offset < uris_size; offset += uri_size)
+    {
+        const char* const uri = uris + offset;
+        uri_size = strlen(uri) + 1;
+
+        if (lv2ui_uris_lookup(&bridge->uiuris, uri) != 0)
+            continue;
+        if (size + uri_size > bridge->ipc->ring_recv->size / 4)
+            break;
+
+        memmove(uris + size, uri, uri_size);
+        last = uris + size;
+        size += uri_size;
+    }
+
+    if (size == 0)
+        return;
+
+    if (! ipc_client_write_msg(bridge->ipc, lv2ui_message_urid_map_batch_req, NULL, 0, uris, size))
+        return;
+
+    ipc_client_commit(bridge->ipc);
+
+    ipc_client_count_roundtrip(bridge->ipc);
+
+    // responses come in order, the last one marks the end of the batch
+    bridge->uiuris.waiting_uri = last;
+
+    while (ipc_client_wait_secs(bridge->ipc, 1) && lv2ui_idle(bridge) == 0 && bridge->uiuris.waiting_uri != NULL) {}
+
+    bridge->uiuris.waiting_uri = NULL;
+}
+
+// called from the main loop when the host commits new messages
+static gboolean lv2ui_notify(const gint fd, const GIOCondition condition, void* const ptr)
+{
+    LV2UI_Bridge* const bridge = ptr;
+
+    ipc_notify_clear(fd);
+    ipc_client_notify_rearm(bridge->ipc);
+    lv2ui_idle(bridge);
+
+    return G_SOURCE_CONTINUE;
+
+    // unused
+    (void)condition;
+}
+
+// fallback for when the host could not provide a pollable handle
+static gboolean lv2ui_notify_timer(void* const ptr)
+{
+    lv2ui_idle(ptr);
+    return G_SOURCE_CONTINUE;
+}
+
+static guint lv2ui_notify_watch(ipc_client_t* const ipc, const GUnixFDSourceFunc func, const GSourceFunc timer_func, void* const ptr)
+{
+    const int32_t fd = ipc_client_notify_fd(ipc);
+
+    if (fd >= 0)
+        return g_unix_fd_add(fd, G_IO_IN, func, ptr);
+
+    return g_timeout_add(16, timer_func, ptr);
+}
+
+// wait for the host to tell a pooled bridge process what to load, returns the plugin URI
+static char* lv2ui_wait_load(LV2UI_Bridge* const bridge, uint64_t* const window_id)
+{
+    const pid_t ppid = getppid();
+    ipc_ring_msg_t msg;
+
+    while (! lv2ui_quit)
+    {
+        if (! ipc_client_peek_msg(bridge->ipc, &msg))
+        {
+            // host is gone, nothing will ever be loaded
+            if (getppid() != ppid)
+                break;
+
+            ipc_client_wait_secs(bridge->ipc, 1);
+            continue;
+        }
+
+        if (msg.type != lv2ui_message_load || msg.size <= sizeof(uint64_t))
+            break;
+
+        uint8_t* const data = malloc(msg.size);
+        if (data == NULL)
+            break;
+
+        ipc_client_consume_msg(bridge->ipc, &msg, data);
+
+        if (data[msg.size - 1] != '\0')
+        {
+            free(data);
+            break;
+        }
+
+        memcpy(window_id, data, sizeof(uint64_t));
+        memmove(data, data + sizeof(uint64_t), msg.size - sizeof(uint64_t));
+        return (char*)data;
+    }
+
+    fprintf(stderr, "lv2ui pooled bridge did not receive a load request\n");
+    return NULL;
+}
+
+static void lv2ui_window_destroyed(GtkWidget* const window, void* const ptr)
+{
+    LV2UI_Bridge* const bridge = ptr;
+    bridge->window = NULL;
+
+    if (gtk_main_level() != 0)
+        gtk_main_quit();
+
+    // unused
+    (void)window;
+}
+
+// load and show a plugin UI, takes ownership of `uri`.
+// if `shm` is set and the bridge is not attached yet, attaches to it first.
+// `watch` adds the bridge to the main loop, shared mode handles wakeups for all bridges at once instead.
+static bool lv2ui_bridge_open(LV2UI_Bridge* const bridge,
+                              char* const uri,
+                              const char* const shm,
+                              const long long winId,
+                              const bool watch)
+{
+    bridge->uri = uri;
+
+    bridge->uiobj = lv2ui_object_load(uri);
+    if (bridge->uiobj == NULL)
+    {
+        fprintf(stderr, "lv2ui failed to load UI details, cannot continue!\n");
+        return false;
+    }
+
+    if (shm != NULL)
+    {
+        if (bridge->ipc == NULL)
+            bridge->ipc = ipc_client_attach(shm);
+        if (bridge->ipc == NULL)
+            return false;
+
+        assert(bridge->ipc->ring_send->size != 0);
+        assert(bridge->ipc->ring_recv->size != 0);
+
+        // user changes are worth waiting a little for when the host does not keep up,
+        // control values that still do not fit stay pending in bridge->controls
+        ipc_client_set_write_policy(bridge->ipc, lv2ui_message_controls, ipc_write_policy_block, 10000);
+
+        // atom data (patch:Set from file pickers, preset loads, MIDI), each message matters
+        ipc_client_set_write_policy(bridge->ipc, lv2ui_message_port_event, ipc_write_policy_never_drop, 0);
+
+        // the host must see these to work properly
+        ipc_client_set_write_policy(bridge->ipc, lv2ui_message_urid_map_req, ipc_write_policy_never_drop, 0);
+        ipc_client_set_write_policy(bridge->ipc, lv2ui_message_urid_map_batch_req, ipc_write_policy_never_drop, 0);
+        ipc_client_set_write_policy(bridge->ipc, lv2ui_message_window_id, ipc_write_policy_never_drop, 0);
+        ipc_client_set_write_policy(bridge->ipc, lv2ui_message_detach, ipc_write_policy_never_drop, 0);
+        ipc_client_set_write_policy(bridge->ipc, lv2ui_message_display_data, ipc_write_policy_never_drop, 0);
+
+        lv2ui_uris_request(bridge, bridge->uiobj->uris, bridge->uiobj->uris_size);
+    }
+
+    // create plug window
+    bridge->window =
+       #ifndef __APPLE__
+        winId != 0 ? gtk_plug_new(winId) :
+       #endif
+        gtk_window_new(GTK_WINDOW_TOPLEVEL);
+
+    if (bridge->window == NULL)
+    {
+        fprintf(stderr, "gtk window creation fail, cannot continue!\n");
+        return false;
+    }
+
+    LV2UI_Widget widget = NULL;
+    bridge->urid_map.handle = bridge;
+    bridge->urid_map.map = lv2ui_uri_map;
+    bridge->feature_urid_map.URI = LV2_URID__map;
+    bridge->feature_urid_map.data = &bridge->urid_map;
+    bridge->features[0] = &bridge->feature_urid_map;
+    bridge->features[1] = NULL;
+    bridge->features[2] = NULL;
+
+    // only meaningful with a host on the other side
+    if (bridge->ipc != NULL)
+    {
+        bridge->display_data.handle = bridge;
+        bridge->display_data.read = lv2ui_display_data_read;
+        bridge->feature_display_data.URI = LV2_GTK_UI_BRIDGE__displayData;
+        bridge->feature_display_data.data = &bridge->display_data;
+        bridge->features[1] = &bridge->feature_display_data;
+    }
+
+    bridge->uihandle = bridge->uiobj->desc->instantiate(bridge->uiobj->desc,
+                                                        uri,
+                                                        bridge->uiobj->bundlepath,
+                                                        lv2ui_write_function,
+                                                        bridge,
+                                                        &widget,
+                                                        bridge->features);
+
+    if (bridge->uihandle == NULL)
+    {
+        fprintf(stderr, "lv2ui failed to initialize, cannot continue!\n");
+        return false;
+    }
+
+    if (widget == NULL)
+    {
+        fprintf(stderr, "lv2ui failed to provide a gtk2 widget, cannot continue!\n");
+        return false;
+    }
+
+    gtk_container_add(GTK_CONTAINER(bridge->window), GTK_WIDGET(widget));
+
+    // handle any pending events before showing window
+    lv2ui_idle(bridge);
+
+   #ifndef __APPLE__
+    if (winId != 0)
+    {
+        gtk_widget_show_all(bridge->window);
+
+        const Window win = gtk_plug_get_id(GTK_PLUG(bridge->window));
+
+        Display* const display = XOpenDisplay(NULL);
+        if (display != NULL)
+        {
+            XMapWindow(display, win);
+            XFlush(display);
+            XCloseDisplay(display);
+        }
+
+        // pass child window id to server side
+        if (bridge->ipc != NULL)
+        {
+            const uint64_t window_id = win;
+            ipc_client_write_msg(bridge->ipc, lv2ui_message_window_id, NULL, 0, &window_id, sizeof(uint64_t));
+            ipc_client_commit(bridge->ipc);
+        }
+    }
+    else
+   #endif
+    if (shm == NULL)
+    {
+        g_signal_connect(G_OBJECT(bridge->window), "destroy", G_CALLBACK(lv2ui_window_destroyed), bridge);
+        gtk_widget_show_all(bridge->window);
+    }
+
+    if (bridge->ipc != NULL && watch)
+        bridge->notify_source = lv2ui_notify_watch(bridge->ipc, lv2ui_notify, lv2ui_notify_timer, bridge);
+
+    fprintf(stderr, "gtk ready '%s' %lld\n", shm, winId);
+    return true;
+}
+
+static void lv2ui_bridge_close(LV2UI_Bridge* const bridge)
+{
+    if (bridge->write_timer != 0)
+    {
+        g_source_remove(bridge->write_timer);
+        bridge->write_timer = 0;
+    }
+
+    if (bridge->notify_source != 0)
+    {
+        g_source_remove(bridge->notify_source);
+        bridge->notify_source = 0;
+    }
+
+    ipc_client_t* const ipc = bridge->ipc;
+
+    if (ipc != NULL)
+    {
+        if (! bridge->detaching)
+            lv2ui_controls_flush(bridge);
+
+        bridge->ipc = NULL;
+    }
+
+    if (bridge->uihandle != NULL)
+    {
+        bridge->uiobj->desc->cleanup(bridge->uihandle);
+        bridge->uihandle = NULL;
+    }
+
+    if (bridge->window != NULL)
+        gtk_widget_destroy(bridge->window);
+
+    if (ipc != NULL)
+    {
+        // let the host know this side is done with the shared memory
+        if (bridge->detaching)
+        {
+            ipc_client_write_msg(ipc, lv2ui_message_detach, NULL, 0, NULL, 0);
+            ipc_client_commit(ipc);
+        }
+
+        ipc_client_dettach(ipc);
+    }
+
+    ipc_snapshot_reader_destroy(&bridge->display);
+    lv2ui_controls_cleanup(&bridge->controls);
+    lv2ui_uris_cleanup(&bridge->uiuris);
+
+    if (bridge->uiobj != NULL)
+    {
+        lv2ui_object_unload(bridge->uiobj);
+        bridge->uiobj = NULL;
+    }
+
+    free(bridge->uri);
+    bridge->uri = NULL;
+}
+
+static gboolean lv2ui_bridge_close_idle(void* const ptr)
+{
+    LV2UI_Bridge* const bridge = ptr;
+
+    for (LV2UI_Bridge** it = &lv2ui_bridges; *it != NULL; it = &(*it)->next)
+    {
+        if (*it == bridge)
+        {
+            *it = bridge->next;
+            break;
+        }
+    }
+
+    lv2ui_bridge_close(bridge);
+    free(bridge);
+    return G_SOURCE_REMOVE;
+}
+
+// interval for sending UI control changes to the host, 0 sends them immediately
+static uint32_t lv2ui_write_interval(void)
+{
+    const char* const write_interval = getenv("LV2_GTK_UI_BRIDGE_WRITE_INTERVAL_MS");
+    return write_interval != NULL ? (uint32_t)atoi(write_interval) : 16;
+}
+
+// shared mode, handles requests from the host to open new UIs in this process
+static int lv2ui_control_idle(void* const ptr)
+{
+    ipc_client_t* const control = ptr;
+
+    ipc_ring_msg_t msg;
+    for (const uint8_t* data; (data = ipc_client_acquire_msg(control, &msg)) != NULL;)
+    {
+        // uint64 parent window id, then NUL-terminated shm name and plugin URI
+        const char* const shm = (const char*)data + sizeof(uint64_t);
+        const char* const shm_end = msg.size > sizeof(uint64_t) ? memchr(shm, '\0', msg.size - sizeof(uint64_t)) : NULL;
+
+        if (msg.type != lv2ui_message_attach || shm_end == NULL || data[msg.size - 1] != '\0' || shm_end + 1 == (const char*)data + msg.size)
+        {
+            fprintf(stderr, "lv2ui client control ringbuffer data race, abort!\n");
+            abort();
+        }
+
+        uint64_t window_id;
+        memcpy(&window_id, data, sizeof(uint64_t));
+
+        LV2UI_Bridge* const bridge = calloc(1, sizeof(LV2UI_Bridge));
+        if (bridge == NULL)
+            continue;
+
+        bridge->write_interval = lv2ui_write_interval();
+
+        if (lv2ui_bridge_open(bridge, strdup(shm_end + 1), shm, (long long)window_id, false))
+        {
+            bridge->next = lv2ui_bridges;
+            lv2ui_bridges = bridge;
+        }
+        else
+        {
+            lv2ui_bridge_close(bridge);
+            free(bridge);
+        }
+    }
+
+    ipc_client_release_msgs(control);
+    return 0;
+}
+
+// all UIs in shared mode are woken up through the same handle as the control channel
+static gboolean lv2ui_control_notify(const gint fd, const GIOCondition condition, void* const ptr)
+{
+    ipc_client_t* const control = ptr;
+
+    ipc_notify_clear(fd);
+    ipc_client_notify_rearm(control);
+    lv2ui_control_idle(control);
+
+    for (LV2UI_Bridge* bridge = lv2ui_bridges; bridge != NULL; bridge = bridge->next)
+    {
+        if (bridge->ipc == NULL)
+            continue;
+
+        ipc_client_notify_rearm(bridge->ipc);
+        lv2ui_idle(bridge);
+    }
+
+    return G_SOURCE_CONTINUE;
+
+    // unused
+    (void)condition;
+}
+
+static gboolean lv2ui_control_notify_timer(void* const ptr)
+{
+    lv2ui_control_notify(-1, G_IO_IN, ptr);
+    return G_SOURCE_CONTINUE;
+}
+
+static void signal_handler(const int sig)
+{
+    lv2ui_quit = 1;
+
+    if (gtk_main_level() != 0)
+        gtk_main_quit();
+
+    // unused
+    (void)sig;
+}
+
+int main(int argc, char* argv[])
+{
+    if (! gtk_init_check(&argc, &argv))
+    {
+        fprintf(stderr, "could not init gtk, cannot continue!\n");
+        return 1;
+    }
+
+    // pooled mode, started ahead of time and told what to load through shared memory later
+    const bool pooled = argc == 3 && strcmp(argv[1], "--pool") == 0;
+
+    // shared mode, hosts several UIs requested through a control channel
+    const bool shared = argc == 3 && strcmp(argv[1], "--shared") == 0;
+
+    if (argc != 2 && argc != 4 && ! pooled && ! shared)
+    {
+        fprintf(stderr, "usage: %s <lv2-uri> [shm-access-key] [x11-ui-parent]\n", argv[0]);
+        fprintf(stderr, "       %s --pool <shm-access-key>\n", argv[0]);
+        fprintf(stderr, "       %s --shared <shm-access-key>\n", argv[0]);
+        return 1;
+    }
+
+    struct sigaction sig = { 0 };
+    sig.sa_handler = signal_handler;
+    sig.sa_flags = SA_RESTART;
+    sigemptyset(&sig.sa_mask);
+    sigaction(SIGTERM, &sig, NULL);
+
+    if (shared)
+    {
+        ipc_client_t* const control = ipc_client_attach(argv[2]);
+        if (control == NULL)
+            return 1;
+
+        const guint source = lv2ui_notify_watch(control, lv2ui_control_notify, lv2ui_control_notify_timer, control);
+
+        gtk_main();
+
+        g_source_remove(source);
+
+        while (lv2ui_bridges != NULL)
+        {
+            LV2UI_Bridge* const bridge = lv2ui_bridges;
+            lv2ui_bridges = bridge->next;
+            lv2ui_bridge_close(bridge);
+            free(bridge);
+        }
+
+        ipc_client_dettach(control);
+        return 0;
+    }
+
+    const char* const shm = argc == 4 || pooled ? argv[2] : NULL;
+    const char* const wid = argc == 4 ? argv[3] : NULL;
+
+    // FIXME hexa create shm
+    long long winId = wid != NULL ? atoll(wid) : 0;
+
+    LV2UI_Bridge bridge = { 0 };
+    bridge.write_interval = lv2ui_write_interval();
+
+    char* uri;
+
+    if (pooled)
+    {
+        bridge.ipc = ipc_client_attach(shm);
+        if (bridge.ipc == NULL)
+            return 1;
+
+        uint64_t window_id = 0;
+        uri = lv2ui_wait_load(&bridge, &window_id);
+        if (uri == NULL)
+        {
+            ipc_client_dettach(bridge.ipc);
+            return 1;
+        }
+
+        winId = (long long)window_id;
+    }
+    else
+    {
+        uri = strdup(argv[1]);
+    }
+
+    if (! lv2ui_bridge_open(&bridge, uri, shm, winId, true))
+    {
+        lv2ui_bridge_close(&bridge);
+        return 1;
+    }
+
+    gtk_main();
 
-fail:
-    lv2ui_uris_cleanup(&bridge.uiuris);
-    lv2ui_object_unload(bridge.uiobj);
+    lv2ui_bridge_close(&bridge);
     return 0;
 }
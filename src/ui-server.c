@@ -3,20 +3,743 @@
 
 #define IPC_LOG_NAME "ipc-server"
 #include "ui-base.h"
+#include "lv2-gtk-ui-bridge.h"
 
+#include <lv2/atom/atom.h>
+#include <lv2/midi/midi.h>
+#include <lv2/parameters/parameters.h>
+#include <lv2/patch/patch.h>
+#include <lv2/time/time.h>
+#include <lv2/units/units.h>
 #include <lv2/urid/urid.h>
 
+#ifdef HAVE_X11
+#include <X11/Xlib.h>
+#endif
+
+// URIs commonly used by UIs, sent to the bridge right after it starts so they need no round-trip later
+static const char* const lv2ui_known_uris[] = {
+    LV2_ATOM__Atom,
+    LV2_ATOM__Blank,
+    LV2_ATOM__Bool,
+    LV2_ATOM__Chunk,
+    LV2_ATOM__Double,
+    LV2_ATOM__Event,
+    LV2_ATOM__Float,
+    LV2_ATOM__Int,
+    LV2_ATOM__Literal,
+    LV2_ATOM__Long,
+    LV2_ATOM__Object,
+    LV2_ATOM__Path,
+    LV2_ATOM__Property,
+    LV2_ATOM__Resource,
+    LV2_ATOM__Sequence,
+    LV2_ATOM__String,
+    LV2_ATOM__Tuple,
+    LV2_ATOM__URI,
+    LV2_ATOM__URID,
+    LV2_ATOM__Vector,
+    LV2_ATOM__atomTransfer,
+    LV2_ATOM__beatTime,
+    LV2_ATOM__eventTransfer,
+    LV2_ATOM__frameTime,
+    LV2_MIDI__MidiEvent,
+    LV2_PARAMETERS__sampleRate,
+    LV2_PATCH__Ack,
+    LV2_PATCH__Error,
+    LV2_PATCH__Get,
+    LV2_PATCH__Message,
+    LV2_PATCH__Patch,
+    LV2_PATCH__Put,
+    LV2_PATCH__Response,
+    LV2_PATCH__Set,
+    LV2_PATCH__add,
+    LV2_PATCH__body,
+    LV2_PATCH__property,
+    LV2_PATCH__readable,
+    LV2_PATCH__remove,
+    LV2_PATCH__sequenceNumber,
+    LV2_PATCH__subject,
+    LV2_PATCH__value,
+    LV2_PATCH__wildcard,
+    LV2_PATCH__writable,
+    LV2_TIME__Position,
+    LV2_TIME__bar,
+    LV2_TIME__barBeat,
+    LV2_TIME__beat,
+    LV2_TIME__beatUnit,
+    LV2_TIME__beatsPerBar,
+    LV2_TIME__beatsPerMinute,
+    LV2_TIME__frame,
+    LV2_TIME__framesPerSecond,
+    LV2_TIME__speed,
+    LV2_UNITS__beat,
+    LV2_UNITS__db,
+    LV2_UNITS__frame,
+    LV2_UNITS__hz,
+    LV2_UNITS__ms,
+    LV2_UNITS__s,
+    LV2_UNITS__unit,
+};
+
+// size of the placeholder window in async mode, until the bridge process embeds its own
+#define LV2UI_PLACEHOLDER_WIDTH 300
+#define LV2UI_PLACEHOLDER_HEIGHT 200
+
+// restarts of a crashed bridge process allowed per period, gives up after that
+#define LV2UI_RESTART_MAX 3
+#define LV2UI_RESTART_PERIOD_NS 60000000000ull
+
+// control channel of a process hosting several UIs, see lv2ui_shared_get.
+// referenced by its pool and by every UI hosted in it, stopped once the last of them lets go even if it crashed.
+typedef struct {
+    ipc_server_t* ipc;
+    uint32_t users;
+} LV2UI_Shared;
+
 typedef struct {
     ipc_server_t* ipc;
+    // owner of the bridge process, differs from ipc when running in a shared process
+    ipc_server_t* process;
+    // set when running in a shared process, keeps `process` valid
+    LV2UI_Shared* shared;
+    bool detached;
+    // details for starting the bridge process again if it crashes
+    char* bridge_tool_path;
+    char* plugin_uri;
+    uint64_t parent_id;
+    bool respawn;
+    uint32_t restart_count;
+    uint64_t restart_period_start;
+    // URIs requested by the bridge process, pushed again to a restarted one
+    char* uris;
+    uint32_t uris_size;
+    uint32_t uris_used;
     LV2UI_Write_Function write_function;
     LV2UI_Controller controller;
     LV2_URID_Map* urid_map;
     uint64_t window_id;
     bool window_ok;
+    // async mode, window given to the host right away, the bridge process embeds its own into it once ready
+    uint64_t placeholder;
+    const LV2UI_Resize* resize;
+    // grow-only scratch memory for incoming messages, kept for the lifetime of the bridge
+    uint8_t* buffer;
+    uint32_t buffer_size;
+    LV2UI_Controls controls;
+    // host provided display data, mirrored into shared memory once the bridged UI asks for it
+    const LV2_GTK_UI_Bridge_Display_Data* display_data;
+    ipc_snapshot_writer_t display;
+    bool display_requested;
 } LV2UI_Bridge;
 
+// bridge processes started ahead of time and parked until a UI is opened, one pool per toolkit.
+// LV2 UIs are only ever used from the host UI thread, so this needs no locking.
+#define LV2UI_POOL_MAX 4
+
+typedef struct {
+    ipc_server_t* ipcs[LV2UI_POOL_MAX];
+    uint32_t count;
+    // process hosting all UIs of this toolkit, when running in shared mode
+    LV2UI_Shared* shared;
+} LV2UI_Pool;
+
+static LV2UI_Pool lv2ui_pools[2];
+
+static void lv2ui_cleanup(LV2UI_Handle ui);
 static int lv2ui_idle(LV2UI_Handle ui);
 
+static bool lv2ui_write_urid(LV2UI_Bridge* const bridge, const char* const uri, const uint32_t uri_size)
+{
+    const uint32_t urid = bridge->urid_map->map(bridge->urid_map->handle, uri);
+
+    return ipc_server_write_msg(bridge->ipc, lv2ui_message_urid_map_resp, &urid, sizeof(uint32_t), uri, uri_size);
+}
+
+// remember a URI requested by the bridge process, so a restarted one does not need to ask again
+static void lv2ui_remember_uri(LV2UI_Bridge* const bridge, const char* const uri, const uint32_t uri_size)
+{
+    if (bridge->uris_used + uri_size > bridge->uris_size)
+    {
+        uint32_t uris_size = bridge->uris_size != 0 ? bridge->uris_size * 2 : 4096;
+        while (bridge->uris_used + uri_size > uris_size)
+            uris_size *= 2;
+
+        char* const uris = realloc(bridge->uris, uris_size);
+        if (uris == NULL)
+            return;
+
+        bridge->uris = uris;
+        bridge->uris_size = uris_size;
+    }
+
+    memcpy(bridge->uris + bridge->uris_used, uri, uri_size);
+    bridge->uris_used += uri_size;
+}
+
+// push well-known and previously requested URIDs before the bridge process asks for them
+static void lv2ui_push_uris(LV2UI_Bridge* const bridge)
+{
+    for (size_t i = 0; i < sizeof(lv2ui_known_uris) / sizeof(lv2ui_known_uris[0]); ++i)
+    {
+        if (! lv2ui_write_urid(bridge, lv2ui_known_uris[i], strlen(lv2ui_known_uris[i]) + 1))
+            break;
+    }
+
+    for (uint32_t offset = 0, uri_size; offset < bridge->uris_used; offset += uri_size)
+    {
+        const char* const uri = bridge->uris + offset;
+        uri_size = strlen(uri) + 1;
+
+        if (! lv2ui_write_urid(bridge, uri, uri_size))
+            break;
+    }
+
+    ipc_server_commit(bridge->ipc);
+}
+
+static void lv2ui_controls_flush(LV2UI_Bridge* const bridge)
+{
+    LV2UI_Controls* const controls = &bridge->controls;
+
+    // nothing to show them yet, all values are sent at once when the window id arrives
+    if (controls->num_dirty == 0 || ! bridge->window_ok)
+        return;
+
+    // as few messages as possible, a full refresh of a big UI usually takes a single one
+    while (controls->num_dirty != 0)
+    {
+        const uint32_t count = lv2ui_controls_pack(controls, bridge->ipc->ring_send);
+        const uint32_t size = sizeof(LV2UI_Bridge_Control) * count;
+
+        if (count == 0 || ! ipc_server_write_msg(bridge->ipc, lv2ui_message_controls, NULL, 0, controls->packed, size))
+            break;
+
+        lv2ui_controls_pop(controls, count);
+    }
+
+    // ring is full, whatever did not fit is sent on the next idle with its latest value
+    ipc_server_commit(bridge->ipc);
+}
+
+// copy the latest display data straight into shared memory, making the region bigger if needed
+static void lv2ui_display_data_update(LV2UI_Bridge* const bridge)
+{
+    if (! bridge->display_requested || bridge->display_data == NULL)
+        return;
+
+    uint8_t* const buffer = ipc_snapshot_writer_begin(&bridge->display);
+    const uint32_t size = bridge->display_data->read(bridge->display_data->handle, buffer, bridge->display.capacity);
+
+    if (buffer != NULL)
+    {
+        if (size != 0 && size <= bridge->display.capacity)
+        {
+            ipc_snapshot_writer_publish(&bridge->display, size);
+            return;
+        }
+
+        ipc_snapshot_writer_cancel(&bridge->display);
+    }
+
+    if (size <= bridge->display.capacity)
+        return;
+
+    if (! ipc_snapshot_writer_create(&bridge->display, bridge->ipc->name, size))
+    {
+        fprintf(stderr, "[lv2-gtk-ui-bridge] failed to create display data region\n");
+        bridge->display_requested = false;
+        return;
+    }
+
+    // filled from the next idle on, the bridge process only sees data once something is published
+    const uint32_t region[2] = { bridge->display.generation, bridge->display.capacity };
+    ipc_server_write_msg(bridge->ipc, lv2ui_message_display_data, NULL, 0, region, sizeof(region));
+    ipc_server_commit(bridge->ipc);
+}
+
+static bool lv2ui_find_shm_name(char shm_name[24])
+{
+    for (int i=0; i < 9999; ++i)
+    {
+        snprintf(shm_name, 23, "lv2-gtk-ui-bridge-%d", i + 1);
+        if (ipc_shm_server_check(shm_name))
+            return true;
+    }
+
+    return false;
+}
+
+// size of each ring, messages that do not comfortably fit go through a separate region created on demand
+static uint32_t lv2ui_ring_size(void)
+{
+    const char* const ring_size = getenv("LV2_GTK_UI_BRIDGE_RING_SIZE");
+    if (ring_size == NULL)
+        return rbsize;
+
+    const int size = atoi(ring_size);
+    if (size <= 0x1000)
+        return 0x1000;
+    if (size >= 0x1000000)
+        return 0x1000000;
+
+    return ((uint32_t)size + IPC_RING_MSG_ALIGN - 1) & ~(uint32_t)(IPC_RING_MSG_ALIGN - 1);
+}
+
+// what to do with messages when the bridge process does not keep up
+static void lv2ui_ipc_setup(ipc_server_t* const ipc)
+{
+    // control values go through lv2ui_message_controls, what is left here is atom and event data.
+    // each of those messages matters (patch:Set for different properties, MIDI, time:Position), keep them all.
+    ipc_server_set_write_policy(ipc, lv2ui_message_port_event, ipc_write_policy_never_drop, 0);
+
+    // the bridge process is waiting for these
+    ipc_server_set_write_policy(ipc, lv2ui_message_urid_map_resp, ipc_write_policy_never_drop, 0);
+    ipc_server_set_write_policy(ipc, lv2ui_message_load, ipc_write_policy_never_drop, 0);
+    ipc_server_set_write_policy(ipc, lv2ui_message_attach, ipc_write_policy_never_drop, 0);
+    ipc_server_set_write_policy(ipc, lv2ui_message_detach, ipc_write_policy_never_drop, 0);
+    ipc_server_set_write_policy(ipc, lv2ui_message_display_data, ipc_write_policy_never_drop, 0);
+}
+
+// `previous` is replaced by the new server if set, see ipc_server_respawn
+static ipc_server_t* lv2ui_ipc_start(const char* args[],
+                                     const char* const shm_name,
+                                     const bool wait,
+                                     ipc_server_t* const previous)
+{
+    // ----------------------------------------------------------------------------------------------------------------
+    // unset known problematic env vars
+
+   #ifdef __linux__
+    char* old_ld_preload = getenv("LD_PRELOAD");
+    if (old_ld_preload != NULL)
+    {
+        old_ld_preload = strdup(old_ld_preload);
+        unsetenv("LD_PRELOAD");
+    }
+
+    char* old_ld_library_path = getenv("LD_LIBRARY_PATH");
+    if (old_ld_library_path != NULL)
+    {
+        old_ld_library_path = strdup(old_ld_library_path);
+        unsetenv("LD_LIBRARY_PATH");
+    }
+   #endif
+
+    // ----------------------------------------------------------------------------------------------------------------
+    // start IPC server
+
+    const uint32_t ring_size = lv2ui_ring_size();
+    ipc_server_t* const ipc = previous != NULL ? ipc_server_respawn(previous, args, shm_name)
+                            : wait ? ipc_server_start(args, shm_name, ring_size)
+                                   : ipc_server_launch(args, shm_name, ring_size);
+
+    if (ipc != NULL)
+        lv2ui_ipc_setup(ipc);
+
+    // ----------------------------------------------------------------------------------------------------------------
+    // cleanup
+
+   #ifdef __linux__
+    if (old_ld_preload != NULL)
+    {
+        setenv("LD_PRELOAD", old_ld_preload, 1);
+        free(old_ld_preload);
+    }
+
+    if (old_ld_library_path != NULL)
+    {
+        setenv("LD_LIBRARY_PATH", old_ld_library_path, 1);
+        free(old_ld_library_path);
+    }
+   #endif
+
+    return ipc;
+}
+
+// number of bridge processes to keep parked per toolkit, 0 (the default) disables pooling
+static uint32_t lv2ui_pool_size(void)
+{
+    const char* const pool_size = getenv("LV2_GTK_UI_BRIDGE_POOL_SIZE");
+    if (pool_size == NULL)
+        return 0;
+
+    const int size = atoi(pool_size);
+    return size <= 0 ? 0 : size >= LV2UI_POOL_MAX ? LV2UI_POOL_MAX : (uint32_t)size;
+}
+
+static ipc_server_t* lv2ui_pool_take(LV2UI_Pool* const pool)
+{
+    while (pool->count != 0)
+    {
+        ipc_server_t* const ipc = pool->ipcs[--pool->count];
+
+        if (ipc_server_is_running(ipc))
+            return ipc;
+
+        ipc_server_stop(ipc);
+    }
+
+    return NULL;
+}
+
+static void lv2ui_pool_fill(LV2UI_Pool* const pool, const char* const bridge_tool_path)
+{
+    const uint32_t pool_size = lv2ui_pool_size();
+
+    while (pool->count < pool_size)
+    {
+        char shm_name[24] = { 0 };
+        if (! lv2ui_find_shm_name(shm_name))
+            break;
+
+        // parked processes initialize their toolkit and then wait for a lv2ui_message_load
+        const char* args[] = { bridge_tool_path, "--pool", shm_name, NULL };
+
+        ipc_server_t* const ipc = lv2ui_ipc_start(args, shm_name, false, NULL);
+        if (ipc == NULL)
+            break;
+
+        pool->ipcs[pool->count++] = ipc;
+    }
+}
+
+// return a placeholder window from instantiate instead of waiting for the bridge process to be ready
+static bool lv2ui_async_enabled(void)
+{
+    const char* const async = getenv("LV2_GTK_UI_BRIDGE_ASYNC");
+    return async != NULL && async[0] != '\0' && strcmp(async, "0") != 0;
+}
+
+#ifdef HAVE_X11
+// X11 connection used by all placeholder windows of this process, open while any of them exists
+static Display* lv2ui_x11_display = NULL;
+static uint32_t lv2ui_x11_users = 0;
+static bool lv2ui_x11_error = false;
+
+static int lv2ui_x11_error_handler(Display* const display, XErrorEvent* const event)
+{
+    lv2ui_x11_error = true;
+    return 0;
+
+    // unused
+    (void)display;
+    (void)event;
+}
+
+// the host may destroy the parent window before cleanup, which takes the placeholder with it.
+// run requests on the placeholder through this so a bad window is ignored instead of the default handler exiting.
+static bool lv2ui_x11_sync_checked(void)
+{
+    const XErrorHandler previous = XSetErrorHandler(lv2ui_x11_error_handler);
+    lv2ui_x11_error = false;
+    XSync(lv2ui_x11_display, False);
+    XSetErrorHandler(previous);
+    return ! lv2ui_x11_error;
+}
+#endif
+
+static bool lv2ui_placeholder_create(LV2UI_Bridge* const bridge, void* const parent)
+{
+   #ifdef HAVE_X11
+    if (lv2ui_x11_display == NULL && (lv2ui_x11_display = XOpenDisplay(NULL)) == NULL)
+        return false;
+
+    const Window window = XCreateSimpleWindow(lv2ui_x11_display,
+                                              (Window)(uintptr_t)parent,
+                                              0, 0,
+                                              LV2UI_PLACEHOLDER_WIDTH, LV2UI_PLACEHOLDER_HEIGHT,
+                                              0, 0, 0);
+
+    // creation and size changes of the window embedded by the bridge process
+    XSelectInput(lv2ui_x11_display, window, SubstructureNotifyMask);
+    XMapWindow(lv2ui_x11_display, window);
+    XFlush(lv2ui_x11_display);
+
+    ++lv2ui_x11_users;
+    bridge->placeholder = window;
+    return true;
+   #else
+    return false;
+
+    // unused
+    (void)bridge;
+    (void)parent;
+   #endif
+}
+
+static void lv2ui_placeholder_destroy(LV2UI_Bridge* const bridge)
+{
+   #ifdef HAVE_X11
+    if (bridge->placeholder == 0)
+        return;
+
+    const Window window = (Window)bridge->placeholder;
+    bridge->placeholder = 0;
+
+    // closing the connection destroys all windows created through it, without requests that could fail
+    if (--lv2ui_x11_users == 0)
+    {
+        XCloseDisplay(lv2ui_x11_display);
+        lv2ui_x11_display = NULL;
+        return;
+    }
+
+    // other placeholders keep the connection open, this window may already be gone together with its parent
+    XDestroyWindow(lv2ui_x11_display, window);
+    lv2ui_x11_sync_checked();
+
+    XEvent event;
+    while (XCheckWindowEvent(lv2ui_x11_display, window, SubstructureNotifyMask, &event)) {}
+   #else
+    (void)bridge;
+   #endif
+}
+
+// follow the size of the window embedded by the bridge process
+static void lv2ui_placeholder_idle(LV2UI_Bridge* const bridge)
+{
+   #ifdef HAVE_X11
+    if (bridge->placeholder == 0)
+        return;
+
+    const Window window = (Window)bridge->placeholder;
+    uint32_t width = 0, height = 0;
+
+    // the connection is shared, leave events of other placeholders to their own idle
+    XEvent event;
+    while (XCheckWindowEvent(lv2ui_x11_display, window, SubstructureNotifyMask, &event))
+    {
+        if (event.type == CreateNotify)
+        {
+            width = event.xcreatewindow.width;
+            height = event.xcreatewindow.height;
+        }
+        else if (event.type == ConfigureNotify && event.xconfigure.window != window)
+        {
+            width = event.xconfigure.width;
+            height = event.xconfigure.height;
+        }
+    }
+
+    if (width == 0 || height == 0)
+        return;
+
+    XResizeWindow(lv2ui_x11_display, window, width, height);
+
+    if (! lv2ui_x11_sync_checked())
+        return;
+
+    if (bridge->resize != NULL)
+        bridge->resize->ui_resize(bridge->resize->handle, (int)width, (int)height);
+   #else
+    (void)bridge;
+   #endif
+}
+
+// host all UIs of the same toolkit in a single bridge process, saves memory and startup time per UI
+static bool lv2ui_shared_enabled(void)
+{
+    const char* const shared = getenv("LV2_GTK_UI_BRIDGE_SHARED");
+    return shared != NULL && shared[0] != '\0' && strcmp(shared, "0") != 0;
+}
+
+static void lv2ui_shared_release(LV2UI_Shared* const shared)
+{
+    if (--shared->users != 0)
+        return;
+
+    ipc_server_stop(shared->ipc);
+    free(shared);
+}
+
+// get the process hosting all UIs of this toolkit, starting it if not running.
+// a crashed one stays alive for the UIs still pointing to it, until they restart or close.
+static LV2UI_Shared* lv2ui_shared_get(LV2UI_Pool* const pool, const char* const bridge_tool_path)
+{
+    if (pool->shared != NULL)
+    {
+        if (ipc_server_is_running(pool->shared->ipc))
+            return pool->shared;
+
+        lv2ui_shared_release(pool->shared);
+        pool->shared = NULL;
+    }
+
+    char shm_name[24] = { 0 };
+    if (! lv2ui_find_shm_name(shm_name))
+        return NULL;
+
+    LV2UI_Shared* const shared = malloc(sizeof(LV2UI_Shared));
+    if (shared == NULL)
+        return NULL;
+
+    const char* args[] = { bridge_tool_path, "--shared", shm_name, NULL };
+
+    shared->ipc = lv2ui_ipc_start(args, shm_name, false, NULL);
+    shared->users = 1;
+
+    if (shared->ipc == NULL)
+    {
+        free(shared);
+        return NULL;
+    }
+
+    pool->shared = shared;
+    return shared;
+}
+
+// open a UI inside the shared bridge process, using a new shared memory segment just for it
+static ipc_server_t* lv2ui_shared_attach(ipc_server_t* const control, const uint64_t parent_id, const char* const plugin_uri)
+{
+    char shm_name[24] = { 0 };
+    if (! lv2ui_find_shm_name(shm_name))
+        return NULL;
+
+    ipc_server_t* const ipc = ipc_server_create(shm_name, lv2ui_ring_size());
+    if (ipc == NULL)
+        return NULL;
+
+    lv2ui_ipc_setup(ipc);
+    ipc_server_share_notify(ipc, control);
+
+    const size_t shm_name_size = strlen(shm_name) + 1;
+    const size_t plugin_uri_size = strlen(plugin_uri) + 1;
+
+    char* const names = malloc(shm_name_size + plugin_uri_size);
+    if (names == NULL)
+    {
+        ipc_server_stop(ipc);
+        return NULL;
+    }
+
+    memcpy(names, shm_name, shm_name_size);
+    memcpy(names + shm_name_size, plugin_uri, plugin_uri_size);
+
+    const bool ok = ipc_server_write_msg(control,
+                                         lv2ui_message_attach,
+                                         &parent_id, sizeof(uint64_t),
+                                         names, shm_name_size + plugin_uri_size);
+    free(names);
+
+    if (! ok)
+    {
+        ipc_server_stop(ipc);
+        return NULL;
+    }
+
+    ipc_server_commit(control);
+    return ipc;
+}
+
+// start a crashed bridge process again, with a new shared memory segment but the same parent window.
+// port values and URIDs known so far are sent again, the UI only blinks.
+static void lv2ui_bridge_respawn(LV2UI_Bridge* const bridge)
+{
+    // crash loop, do not keep burning CPU on it
+    const uint64_t now = ipc_time_ns();
+
+    if (now - bridge->restart_period_start > LV2UI_RESTART_PERIOD_NS)
+    {
+        bridge->restart_period_start = now;
+        bridge->restart_count = 0;
+    }
+
+    if (bridge->restart_count >= LV2UI_RESTART_MAX)
+    {
+        fprintf(stderr, "[lv2-gtk-ui-bridge] bridge process keeps exiting, giving up\n");
+        bridge->respawn = false;
+        return;
+    }
+
+    ++bridge->restart_count;
+
+    fprintf(stderr, "[lv2-gtk-ui-bridge] bridge process exited, restarting\n");
+
+    char shm_name[24] = { 0 };
+    if (! lv2ui_find_shm_name(shm_name))
+        return;
+
+    char wid[24] = { 0 };
+    snprintf(wid, sizeof(wid) - 1, "%llu", (unsigned long long)bridge->parent_id);
+
+    // always a dedicated process, a crashed shared one is restarted for the next UI that needs it
+    const char* args[] = { bridge->bridge_tool_path, bridge->plugin_uri, shm_name, wid, NULL };
+
+    ipc_server_t* const ipc = lv2ui_ipc_start(args, shm_name, false, bridge->ipc);
+    if (ipc == NULL)
+        return;
+
+    bridge->ipc = bridge->process = ipc;
+    bridge->detached = false;
+
+    if (bridge->shared != NULL)
+    {
+        lv2ui_shared_release(bridge->shared);
+        bridge->shared = NULL;
+    }
+
+    // control values are sent once the new process reports its window, see lv2ui_message_window_id
+    bridge->window_ok = false;
+
+    // the new process asks again for display data if it needs it
+    ipc_snapshot_writer_destroy(&bridge->display);
+    bridge->display_requested = false;
+
+    lv2ui_push_uris(bridge);
+}
+
+static void lv2ui_bridge_stop(LV2UI_Bridge* const bridge)
+{
+    bridge->respawn = false;
+
+    // shared process keeps running, ask it to close this UI and wait until it no longer uses our memory
+    if (bridge->process != bridge->ipc)
+    {
+        bridge->write_function = NULL;
+
+        if (ipc_server_write_msg(bridge->ipc, lv2ui_message_detach, NULL, 0, NULL, 0))
+        {
+            ipc_server_commit(bridge->ipc);
+
+            for (int i = 0; i < 2 && !bridge->detached && ipc_server_is_running(bridge->process);)
+            {
+                if (! ipc_server_wait_secs(bridge->ipc, 1))
+                    ++i;
+                else if (lv2ui_idle(bridge) != 0)
+                    break;
+            }
+        }
+    }
+
+    ipc_server_stop(bridge->ipc);
+    ipc_snapshot_writer_destroy(&bridge->display);
+
+    if (bridge->shared != NULL)
+    {
+        lv2ui_shared_release(bridge->shared);
+        bridge->shared = NULL;
+    }
+}
+
+__attribute__((destructor))
+static void lv2ui_pool_cleanup(void)
+{
+    for (size_t i = 0; i < sizeof(lv2ui_pools) / sizeof(lv2ui_pools[0]); ++i)
+    {
+        LV2UI_Pool* const pool = &lv2ui_pools[i];
+
+        while (pool->count != 0)
+            ipc_server_stop(pool->ipcs[--pool->count]);
+
+        if (pool->shared != NULL)
+        {
+            lv2ui_shared_release(pool->shared);
+            pool->shared = NULL;
+        }
+    }
+}
+
 static LV2UI_Handle lv2ui_instantiate(const LV2UI_Descriptor* const descriptor,
                                       const char* const plugin_uri,
                                       const char* const bundle_path,
@@ -32,6 +755,8 @@ static LV2UI_Handle lv2ui_instantiate(const LV2UI_Descriptor* const descriptor,
 
     void* parent = NULL;
     LV2_URID_Map* urid_map = NULL;
+    const LV2_GTK_UI_Bridge_Display_Data* display_data = NULL;
+    const LV2UI_Resize* resize = NULL;
 
     for (int i=0; features[i] != NULL; ++i)
     {
@@ -39,6 +764,10 @@ static LV2UI_Handle lv2ui_instantiate(const LV2UI_Descriptor* const descriptor,
             parent = features[i]->data;
         else if (strcmp(features[i]->URI, LV2_URID__map) == 0)
             urid_map = features[i]->data;
+        else if (strcmp(features[i]->URI, LV2_GTK_UI_BRIDGE__displayData) == 0)
+            display_data = features[i]->data;
+        else if (strcmp(features[i]->URI, LV2_UI__resize) == 0)
+            resize = features[i]->data;
     }
     if (parent == NULL)
     {
@@ -55,11 +784,35 @@ static LV2UI_Handle lv2ui_instantiate(const LV2UI_Descriptor* const descriptor,
     // alloc memory for our bridge details
 
     LV2UI_Bridge* const bridge = malloc(sizeof(LV2UI_Bridge));
+    bridge->plugin_uri = strdup(plugin_uri);
+    bridge->parent_id = (uint64_t)(uintptr_t)parent;
+    bridge->respawn = false;
+    bridge->restart_count = 0;
+    bridge->restart_period_start = 0;
+    bridge->uris = NULL;
+    bridge->uris_size = 0;
+    bridge->uris_used = 0;
     bridge->write_function = write_function;
     bridge->controller = controller;
     bridge->urid_map = urid_map;
+    bridge->ipc = NULL;
+    bridge->process = NULL;
+    bridge->shared = NULL;
+    bridge->detached = false;
     bridge->window_id = 0;
     bridge->window_ok = false;
+    bridge->placeholder = 0;
+    bridge->resize = resize != NULL && resize->ui_resize != NULL ? resize : NULL;
+    bridge->buffer = NULL;
+    bridge->buffer_size = 0;
+    bridge->controls.ports = NULL;
+    bridge->controls.dirty_list = NULL;
+    bridge->controls.packed = NULL;
+    bridge->controls.num_ports = 0;
+    bridge->controls.num_dirty = 0;
+    bridge->display_data = display_data != NULL && display_data->read != NULL ? display_data : NULL;
+    memset(&bridge->display, 0, sizeof(bridge->display));
+    bridge->display_requested = false;
 
     // ----------------------------------------------------------------------------------------------------------------
     // path to bridge helper
@@ -71,17 +824,22 @@ static LV2UI_Handle lv2ui_instantiate(const LV2UI_Descriptor* const descriptor,
    #endif
 
     const char* bridge_tool;
+    LV2UI_Pool* pool;
     if (strcmp(descriptor->URI, "https://kx.studio/lv2-gtk2-ui-bridge") == 0)
     {
         bridge_tool = "lv2-gtk2-ui-bridge" APP_EXT;
+        pool = &lv2ui_pools[0];
     }
     else if (strcmp(descriptor->URI, "https://kx.studio/lv2-gtk3-ui-bridge") == 0)
     {
         bridge_tool = "lv2-gtk3-ui-bridge" APP_EXT;
+        pool = &lv2ui_pools[1];
     }
     else
     {
         fprintf(stderr, "invalid descriptor URI, cannot continue!\n");
+        free(bridge->plugin_uri);
+        free(bridge);
         return NULL;
     }
 
@@ -91,77 +849,82 @@ static LV2UI_Handle lv2ui_instantiate(const LV2UI_Descriptor* const descriptor,
     char* const bridge_tool_path = malloc(bundle_path_len + bridge_tool_len + 1);
     memcpy(bridge_tool_path, bundle_path, bundle_path_len);
     memcpy(bridge_tool_path + bundle_path_len, bridge_tool, bridge_tool_len + 1);
+    bridge->bridge_tool_path = bridge_tool_path;
 
     // ----------------------------------------------------------------------------------------------------------------
-    // find usable shm name
-
-    char shm_name[24] = { 0 };
-    for (int i=0; i < 9999; ++i)
-    {
-        snprintf(shm_name, sizeof(shm_name) - 1, "lv2-gtk-ui-bridge-%d", i + 1);
-        if (ipc_shm_server_check(shm_name))
-            break;
-    }
+    // in async mode the bridge process embeds into a placeholder window, which is given to the host right away
 
-    // ----------------------------------------------------------------------------------------------------------------
-    // convert parent window id into a string
+    const bool async = lv2ui_async_enabled() && lv2ui_placeholder_create(bridge, parent);
 
-    char wid[24] = { 0 };
-    // FIXME hexa
-    snprintf(wid, sizeof(wid) - 1, "%llu", (unsigned long long)parent);
+    if (async)
+        bridge->parent_id = bridge->placeholder;
 
     // ----------------------------------------------------------------------------------------------------------------
-    // unset known problematic env vars
+    // use the shared or a parked bridge process if available, otherwise start a new one
 
-   #ifdef __linux__
-    char* old_ld_preload = getenv("LD_PRELOAD");
-    if (old_ld_preload != NULL)
+    const bool shared = lv2ui_shared_enabled();
+
+    if (shared)
     {
-        old_ld_preload = strdup(old_ld_preload);
-        unsetenv("LD_PRELOAD");
-    }
+        LV2UI_Shared* const control = lv2ui_shared_get(pool, bridge_tool_path);
 
-    char* old_ld_library_path = getenv("LD_LIBRARY_PATH");
-    if (old_ld_library_path != NULL)
+        if (control != NULL && (bridge->ipc = lv2ui_shared_attach(control->ipc, bridge->parent_id, plugin_uri)) != NULL)
+        {
+            bridge->process = control->ipc;
+            bridge->shared = control;
+            ++control->users;
+        }
+    }
+    else if ((bridge->ipc = lv2ui_pool_take(pool)) != NULL)
     {
-        old_ld_library_path = strdup(old_ld_library_path);
-        unsetenv("LD_LIBRARY_PATH");
+        if (! ipc_server_write_msg(bridge->ipc,
+                                   lv2ui_message_load,
+                                   &bridge->parent_id, sizeof(uint64_t),
+                                   plugin_uri, strlen(plugin_uri) + 1))
+        {
+            ipc_server_stop(bridge->ipc);
+            bridge->ipc = NULL;
+        }
     }
-   #endif
 
-    // ----------------------------------------------------------------------------------------------------------------
-    // start IPC server
-
-    const char* args[] = { bridge_tool_path, plugin_uri, shm_name, wid, NULL };
+    if (bridge->ipc == NULL)
+    {
+        // find usable shm name
+        char shm_name[24] = { 0 };
+        lv2ui_find_shm_name(shm_name);
 
-    bridge->ipc = ipc_server_start(args, shm_name, rbsize);
+        // convert parent window id into a string
+        char wid[24] = { 0 };
+        // FIXME hexa
+        snprintf(wid, sizeof(wid) - 1, "%llu", (unsigned long long)bridge->parent_id);
 
-    // ----------------------------------------------------------------------------------------------------------------
-    // cleanup
+        const char* args[] = { bridge_tool_path, plugin_uri, shm_name, wid, NULL };
 
-   #ifdef __linux__
-    if (old_ld_preload != NULL)
-    {
-        setenv("LD_PRELOAD", old_ld_preload, 1);
-        free(old_ld_preload);
+        bridge->ipc = lv2ui_ipc_start(args, shm_name, ! async, NULL);
     }
 
-    if (old_ld_library_path != NULL)
-    {
-        setenv("LD_LIBRARY_PATH", old_ld_library_path, 1);
-        free(old_ld_library_path);
-    }
-   #endif
+    if (bridge->process == NULL)
+        bridge->process = bridge->ipc;
 
-    free(bridge_tool_path);
+    // park new processes for the next UIs
+    if (! shared)
+        lv2ui_pool_fill(pool, bridge_tool_path);
 
     if (bridge->ipc == NULL)
     {
         fprintf(stderr, "[lv2-gtk-ui-bridge] ipc_server_start failed\n");
+        lv2ui_placeholder_destroy(bridge);
+        free(bridge->bridge_tool_path);
+        free(bridge->plugin_uri);
         free(bridge);
         return NULL;
     }
 
+    // ----------------------------------------------------------------------------------------------------------------
+    // push well-known URIDs before the UI asks for them
+
+    lv2ui_push_uris(bridge);
+
     // ----------------------------------------------------------------------------------------------------------------
     // if we have a parent wait for first message, giving window id to host
 
@@ -171,17 +934,31 @@ static LV2UI_Handle lv2ui_instantiate(const LV2UI_Descriptor* const descriptor,
         return bridge;
     }
 
-    while (ipc_server_wait_secs(bridge->ipc, 1) && lv2ui_idle(bridge) == 0 && !bridge->window_ok) {}
+    // control values and size are taken care of once the bridge process reports its window
+    if (async)
+    {
+        *widget = (LV2UI_Widget)(uintptr_t)bridge->placeholder;
+        bridge->respawn = true;
+        return bridge;
+    }
+
+    for (int i = 0; i < 5 && !bridge->window_ok && ipc_server_is_running(bridge->process);)
+    {
+        if (! ipc_server_wait_secs(bridge->ipc, 1))
+            ++i;
+        else if (lv2ui_idle(bridge) != 0)
+            break;
+    }
 
     if (bridge->window_ok)
     {
         *widget = (LV2UI_Widget)bridge->window_id;
+        bridge->respawn = true;
         return bridge;
     }
 
     fprintf(stderr, "[lv2-gtk-ui-bridge] ipc_server_start failed to fetch initial response\n");
-    ipc_server_stop(bridge->ipc);
-    free(bridge);
+    lv2ui_cleanup(bridge);
     return NULL;
 }
 
@@ -189,7 +966,13 @@ static void lv2ui_cleanup(const LV2UI_Handle ui)
 {
     LV2UI_Bridge* const bridge = ui;
 
-    ipc_server_stop(bridge->ipc);
+    lv2ui_bridge_stop(bridge);
+    lv2ui_placeholder_destroy(bridge);
+    lv2ui_controls_cleanup(&bridge->controls);
+    free(bridge->buffer);
+    free(bridge->uris);
+    free(bridge->bridge_tool_path);
+    free(bridge->plugin_uri);
     free(bridge);
 }
 
@@ -197,12 +980,18 @@ static void lv2ui_port_event(LV2UI_Handle ui, uint32_t port_index, uint32_t buff
 {
     LV2UI_Bridge* const bridge = ui;
 
-    const uint32_t msg_type = lv2ui_message_port_event;
-    ipc_server_write(bridge->ipc, &msg_type, sizeof(uint32_t)) &&
-    ipc_server_write(bridge->ipc, &port_index, sizeof(uint32_t)) &&
-    ipc_server_write(bridge->ipc, &buffer_size, sizeof(uint32_t)) &&
-    ipc_server_write(bridge->ipc, &format, sizeof(uint32_t)) &&
-    ipc_server_write(bridge->ipc, buffer, buffer_size);
+    // control ports only need their latest value, coalesce them until the next idle
+    if (format == 0 && buffer_size == sizeof(float))
+    {
+        float value;
+        memcpy(&value, buffer, sizeof(float));
+
+        if (lv2ui_controls_set(&bridge->controls, port_index, value))
+            return;
+    }
+
+    const LV2UI_Bridge_Port_Event event = { port_index, format };
+    ipc_server_write_msg(bridge->ipc, lv2ui_message_port_event, &event, sizeof(event), buffer, buffer_size);
     ipc_server_commit(bridge->ipc);
 }
 
@@ -210,81 +999,129 @@ static int lv2ui_idle(const LV2UI_Handle ui)
 {
     LV2UI_Bridge* const bridge = ui;
 
-    uint32_t size = 0;
-    void* buffer = NULL;
+    if (bridge->respawn && ! ipc_server_is_running(bridge->process))
+        lv2ui_bridge_respawn(bridge);
+
+    lv2ui_placeholder_idle(bridge);
+
+    lv2ui_controls_flush(bridge);
+    lv2ui_display_data_update(bridge);
 
-    while (ipc_server_read_size(bridge->ipc) != 0)
+    // keep sending what is left of large messages split in fragments
+    if (ipc_server_backlog_size(bridge->ipc) != 0)
+        ipc_server_commit(bridge->ipc);
+
+    // reset the pollable handle before reading, so that anything committed from now on signals it again
+    ipc_server_notify_clear(bridge->ipc);
+
+    // copy messages out of shared memory before use, the host must not read memory the bridge process can modify
+    ipc_ring_msg_t msg;
+    while (ipc_server_peek_msg(bridge->ipc, &msg))
     {
-        uint32_t msg_type = lv2ui_message_null;
-        if (ipc_server_read(bridge->ipc, &msg_type, sizeof(uint32_t)))
+        if (msg.size > bridge->buffer_size)
         {
-            uint32_t port_index, buffer_size, port_protocol;
-            switch (msg_type)
+            uint8_t* const buffer = realloc(bridge->buffer, msg.size);
+
+            if (buffer == NULL)
             {
-            case lv2ui_message_port_event:
-                if (ipc_server_read(bridge->ipc, &port_index, sizeof(uint32_t)) &&
-                    ipc_server_read(bridge->ipc, &buffer_size, sizeof(uint32_t)) &&
-                    ipc_server_read(bridge->ipc, &port_protocol, sizeof(uint32_t)))
-                {
-                    if (buffer_size > size)
-                    {
-                        size = buffer_size;
-                        buffer = realloc(buffer, buffer_size);
-
-                        if (buffer == NULL)
-                        {
-                            fprintf(stderr, "lv2ui server out of memory, abort!\n");
-                            return 1;
-                        }
-                    }
-
-                    if (ipc_server_read(bridge->ipc, buffer, buffer_size))
-                    {
-                        if (bridge->write_function != NULL)
-                            bridge->write_function(bridge->controller, port_index, buffer_size, port_protocol, buffer);
-
-                        continue;
-                    }
-                }
-                break;
-            case lv2ui_message_urid_map_req:
-                if (ipc_server_read(bridge->ipc, &buffer_size, sizeof(uint32_t)))
+                fprintf(stderr, "lv2ui server out of memory, abort!\n");
+                return 1;
+            }
+
+            bridge->buffer = buffer;
+            bridge->buffer_size = msg.size;
+        }
+
+        uint8_t* const buffer = bridge->buffer;
+        ipc_server_consume_msg(bridge->ipc, &msg, buffer);
+
+        switch (msg.type)
+        {
+        case lv2ui_message_port_event:
+            if (msg.size >= sizeof(LV2UI_Bridge_Port_Event))
+            {
+                const LV2UI_Bridge_Port_Event* const event = (const LV2UI_Bridge_Port_Event*)buffer;
+
+                if (bridge->write_function != NULL)
+                    bridge->write_function(bridge->controller,
+                                           event->port_index,
+                                           msg.size - sizeof(LV2UI_Bridge_Port_Event),
+                                           event->format,
+                                           buffer + sizeof(LV2UI_Bridge_Port_Event));
+
+                continue;
+            }
+            break;
+        case lv2ui_message_controls:
+            if (msg.size != 0 && msg.size % sizeof(LV2UI_Bridge_Control) == 0)
+            {
+                const LV2UI_Bridge_Control* const values = (const LV2UI_Bridge_Control*)buffer;
+
+                if (bridge->write_function != NULL)
                 {
-                    if (buffer_size > size)
-                    {
-                        size = buffer_size;
-                        buffer = realloc(buffer, buffer_size);
-
-                        if (buffer == NULL)
-                        {
-                            fprintf(stderr, "lv2ui server out of memory, abort!\n");
-                            return 1;
-                        }
-                    }
-
-                    if (ipc_server_read(bridge->ipc, buffer, buffer_size))
-                    {
-                        const uint32_t urid = bridge->urid_map->map(bridge->urid_map->handle, buffer);
-
-                        const uint32_t msg_type = lv2ui_message_urid_map_resp;
-                        ipc_server_write(bridge->ipc, &msg_type, sizeof(uint32_t)) &&
-                        ipc_server_write(bridge->ipc, &urid, sizeof(uint32_t)) &&
-                        ipc_server_write(bridge->ipc, &buffer_size, sizeof(uint32_t)) &&
-                        ipc_server_write(bridge->ipc, buffer, buffer_size);
-                        ipc_server_commit(bridge->ipc);
-
-                        continue;
-                    }
+                    for (uint32_t i = 0, count = msg.size / sizeof(LV2UI_Bridge_Control); i < count; ++i)
+                        bridge->write_function(bridge->controller,
+                                               values[i].port_index,
+                                               sizeof(float),
+                                               0,
+                                               &values[i].value);
                 }
-                break;
-            case lv2ui_message_window_id:
-                if (ipc_server_read(bridge->ipc, &bridge->window_id, sizeof(uint64_t)))
+
+                continue;
+            }
+            break;
+        case lv2ui_message_urid_map_req:
+            if (msg.size != 0)
+            {
+                buffer[msg.size - 1] = '\0';
+
+                lv2ui_remember_uri(bridge, (const char*)buffer, strlen((const char*)buffer) + 1);
+                lv2ui_write_urid(bridge, (const char*)buffer, msg.size);
+                ipc_server_commit(bridge->ipc);
+
+                continue;
+            }
+            break;
+        case lv2ui_message_urid_map_batch_req:
+            if (msg.size != 0)
+            {
+                buffer[msg.size - 1] = '\0';
+
+                for (uint32_t offset = 0, uri_size; offset < msg.size; offset += uri_size)
                 {
-                    bridge->window_ok = true;
-                    continue;
+                    const char* const uri = (const char*)buffer + offset;
+                    uri_size = strlen(uri) + 1;
+
+                    lv2ui_remember_uri(bridge, uri, uri_size);
+
+                    if (! lv2ui_write_urid(bridge, uri, uri_size))
+                        break;
                 }
-                break;
+
+                ipc_server_commit(bridge->ipc);
+
+                continue;
             }
+            break;
+        case lv2ui_message_window_id:
+            if (msg.size == sizeof(uint64_t))
+            {
+                memcpy(&bridge->window_id, buffer, sizeof(uint64_t));
+                bridge->window_ok = true;
+
+                // UI is ready, bring it up to date in as few messages as possible
+                lv2ui_controls_mark_all(&bridge->controls);
+                lv2ui_controls_flush(bridge);
+                continue;
+            }
+            break;
+        case lv2ui_message_detach:
+            bridge->detached = true;
+            continue;
+        case lv2ui_message_display_data:
+            // without host support the bridged UI simply never gets any data
+            bridge->display_requested = true;
+            continue;
         }
 
         fprintf(stderr, "lv2ui server ringbuffer data race, abort!\n");
@@ -294,6 +1131,13 @@ static int lv2ui_idle(const LV2UI_Handle ui)
     return 0;
 }
 
+static int lv2ui_get_fd(const LV2UI_Handle ui)
+{
+    LV2UI_Bridge* const bridge = ui;
+
+    return ipc_server_notify_fd(bridge->ipc);
+}
+
 static const void* lv2ui_extension_data(const char* const uri)
 {
     if (strcmp(uri, LV2_UI__idleInterface) == 0)
@@ -304,6 +1148,14 @@ static const void* lv2ui_extension_data(const char* const uri)
         return &idle_interface;
     }
 
+    if (strcmp(uri, LV2_GTK_UI_BRIDGE__notifyInterface) == 0)
+    {
+        static const LV2_GTK_UI_Bridge_Notify_Interface notify_interface = {
+            .get_fd = lv2ui_get_fd,
+        };
+        return &notify_interface;
+    }
+
     return NULL;
 }
 